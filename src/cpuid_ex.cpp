@@ -4,6 +4,7 @@
 
 #if defined(_MSC_VER)
 #include <intrin.h>
+#include <immintrin.h>
 #endif
 
 extern "C" void cpuid(uint32_t code, cpuid_regs* regs) {
@@ -68,4 +69,38 @@ extern "C" void cpuidex(uint32_t code, uint32_t subcode, cpuid_regs* regs) {
 #else
 	#error "Only MSVC, GCC, Clang are supported!"
 #endif
+}
+
+extern "C" uint64_t xgetbv(uint32_t index) {
+#if defined(_MSC_VER)
+	return _xgetbv(index);
+#elif defined(__GNUC__) || defined(__clang__)
+	uint32_t eax, edx;
+	__asm__ volatile(
+		".byte 0x0f, 0x01, 0xd0"
+		: "=a" (eax), "=d" (edx)
+		: "c" (index)
+	);
+	return ((uint64_t)edx << 32) | eax;
+#else
+	#error "Only MSVC, GCC, Clang are supported!"
+#endif
+}
+
+extern "C" void mxcsrinfo(uint32_t* mxcsr, uint32_t* mask) {
+	// FXSAVE area: MXCSR at byte 24, MXCSR_MASK at byte 28
+	alignas(16) uint8_t area[512] = {};
+#if defined(_MSC_VER)
+	_fxsave(area);
+#elif defined(__GNUC__) || defined(__clang__)
+	__asm__ volatile("fxsave %0" : "=m" (area));
+#else
+	#error "Only MSVC, GCC, Clang are supported!"
+#endif
+	*mxcsr = (uint32_t)area[24] | ((uint32_t)area[25] << 8) | ((uint32_t)area[26] << 16) | ((uint32_t)area[27] << 24);
+	*mask = (uint32_t)area[28] | ((uint32_t)area[29] << 8) | ((uint32_t)area[30] << 16) | ((uint32_t)area[31] << 24);
+	
+	// A zero mask means the processor predates DAZ and uses the default mask
+	if (*mask == 0)
+		*mask = 0xFFBF;
 }
\ No newline at end of file
@@ -15,6 +15,8 @@ typedef struct {
 
 void cpuid(uint32_t code, cpuid_regs* regs);
 void cpuidex(uint32_t code, uint32_t subcode, cpuid_regs* regs);
+uint64_t xgetbv(uint32_t index);
+void mxcsrinfo(uint32_t* mxcsr, uint32_t* mask);
 
 #ifdef __cplusplus
 }
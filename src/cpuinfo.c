@@ -11,6 +11,9 @@
 #define CPU_AMD 1
 #define CPU_OTHER 2
 
+#define MXCSR_DAZ 0x40
+#define MXCSR_FTZ 0x8000
+
 int cpuModel = CPU_UNDEFINED;
 
 void loadRegString(char* str, uint32_t reg, int first) {
@@ -242,14 +245,15 @@ void dispCPUFeaturesExtended() {
 	cpuid(1, &regs);
 	uint32_t mce = (regs.edx & 0x80); // ADDED
 	uint32_t cx8 = (regs.edx & 0x100); // ADDED
-	uint32_t sep = (regs.edx & 0x400); // ADDED
+	uint32_t sep = (regs.edx & 0x800); // ADDED
+	uint32_t rdrand = (regs.ecx & 0x40000000);
 	
 	clearRegs(&regs);
 	
 	// EAX = 7 ECX = 0
 	cpuid(7, &regs);
 	uint32_t bmi1 = (regs.ebx & 0x8);
-	uint32_t smap = (regs.ebx & 0x80);
+	uint32_t smap = (regs.ebx & 0x100000);
 	uint32_t bmi2 = (regs.ebx & 0x100);
 	uint32_t rdseed = (regs.ebx & 0x40000);
 	uint32_t adx = (regs.ebx & 0x80000);
@@ -267,22 +271,149 @@ void dispCPUFeaturesExtended() {
 	uint32_t lzcnt = (regs.ecx & 0x20);
 	uint32_t sse4a = (regs.ecx & 0x40);
 	uint32_t fma4 = (regs.ecx & 0x10000);
-	uint32_t prefetchw = (regs.ecx & 0x20000000);
+	uint32_t prefetchw = (regs.ecx & 0x100);
 	
 	clearRegs(&regs);
 	
 	// EAX = 0x80000008 ECX = 0
 	cpuid(0x80000008, &regs);
 	uint32_t clzero = (regs.ebx & 0x1);
-	uint32_t wbnoinvd = (regs.ebx & 0x4);
+	uint32_t wbnoinvd = (regs.ebx & 0x200);
+	
+	printf("CPU EXTENDED FEATURES\n");
+	printCpuInfoSupportedState("MCE", mce);
+	printCpuInfoSupportedState("CX8", cx8);
+	printCpuInfoSupportedState("SEP", sep);
+	printCpuInfoSupportedState("RDRAND", rdrand);
+	printCpuInfoSupportedState("BMI1", bmi1);
+	printCpuInfoSupportedState("SMAP", smap);
+	printCpuInfoSupportedState("BMI2", bmi2);
+	printCpuInfoSupportedState("RDSEED", rdseed);
+	printCpuInfoSupportedState("ADX", adx);
+	printCpuInfoSupportedState("SHA", sha);
+	printCpuInfoSupportedState("SYSCALL", syscall);
+	printCpuInfoSupportedState("NX", nx);
+	printCpuInfoSupportedState("3DNow!", _3dnow);
+	printCpuInfoSupportedState("LZCNT", lzcnt);
+	printCpuInfoSupportedState("SSE4a", sse4a);
+	printCpuInfoSupportedState("FMA4", fma4);
+	printCpuInfoSupportedState("PREFETCHW", prefetchw);
+	printCpuInfoSupportedState("CLZERO", clzero);
+	printCpuInfoSupportedState("WBNOINVD", wbnoinvd);
+	printf("\n");
+}
+
+void dispSpinWaitFeatures() {
+	cpuid_regs regs = {};
+	
+	// EAX = 1 ECX = 0
+	cpuid(1, &regs);
+	uint32_t sse2 = (regs.edx & 0x4000000);
+	uint32_t monitor = (regs.ecx & 0x8);
 	
 	clearRegs(&regs);
 	
-	// EAX = 6 ECX = 0
-	cpuid(0x6, &regs);
-	uint32_t dts = (regs.eax & 0x1);
-	uint32_t turboBoost = (regs.eax & 0x40);
-	uint32_t arat = (regs.eax & 0x80);
+	// EAX = 7 ECX = 0
+	cpuid(7, &regs);
+	uint32_t waitpkg = (regs.ecx & 0x20);
+	
+	clearRegs(&regs);
+	
+	// EAX = 0x80000001 ECX = 0
+	cpuid(0x80000001, &regs);
+	uint32_t monitorx = (regs.ecx & 0x20000000);
+	
+	printf("SPIN-WAIT FEATURES\n");
+	printCpuInfoSupportedState("PAUSE", sse2);
+	printCpuInfoSupportedState("MONITOR/MWAIT", monitor);
+	printCpuInfoSupportedState("WAITPKG (UMONITOR/UMWAIT/TPAUSE)", waitpkg);
+	printCpuInfoSupportedState("MONITORX/MWAITX", monitorx);
+	printf("\n");
+}
+
+void dispFPControl() {
+	uint32_t mxcsr = 0;
+	uint32_t mxcsrMask = 0;
+	
+	// MXCSR and MXCSR_MASK from the FXSAVE area
+	mxcsrinfo(&mxcsr, &mxcsrMask);
+	
+	printf("FLOATING-POINT CONTROL\n");
+	printCpuInfoString("MXCSR", mxcsr);
+	printCpuInfoString("MXCSR mask", mxcsrMask);
+	printCpuInfoSupportedState("Flush-to-zero (FTZ)", mxcsrMask & MXCSR_FTZ);
+	printCpuInfoSupportedState("Denormals-are-zero (DAZ)", mxcsrMask & MXCSR_DAZ);
+	printf("	FTZ state: %s\n", (mxcsr & MXCSR_FTZ) ? "Enabled" : "Disabled");
+	printf("	DAZ state: %s\n", (mxcsr & MXCSR_DAZ) ? "Enabled" : "Disabled");
+	printf("\n");
+}
+
+void dispPerfMonitoring() {
+	cpuid_regs regs = {};
+	
+	// EAX = 0 ECX = 0
+	cpuid(0, &regs);
+	uint32_t maxFunctionCode = regs.eax;
+	
+	clearRegs(&regs);
+	
+	// EAX = 0xA ECX = 0
+	if (maxFunctionCode >= 0xA)
+		cpuid(0xA, &regs);
+	uint32_t version = extractBits(regs.eax, 7, 0);
+	uint32_t gpCounters = extractBits(regs.eax, 15, 8);
+	uint32_t gpWidth = extractBits(regs.eax, 23, 16);
+	uint32_t eventVectorLength = extractBits(regs.eax, 31, 24);
+	uint32_t unavailableEvents = regs.ebx;
+	uint32_t fixedCounterMask = regs.ecx;
+	uint32_t fixedCounters = extractBits(regs.edx, 4, 0);
+	uint32_t fixedWidth = extractBits(regs.edx, 12, 5);
+	uint32_t anyThreadDeprecated = (regs.edx & 0x8000);
+	
+	printf("ARCHITECTURAL PERFORMANCE MONITORING\n");
+	printCpuInfoString("Version", version);
+	
+	if (version == 0) {
+		// AMD reports its core counters through EAX = 0x80000022 (PerfMonV2)
+		if (cpuModel == CPU_AMD) {
+			clearRegs(&regs);
+			cpuid(0x80000000, &regs);
+			uint32_t maxExtendedCode = regs.eax;
+			
+			clearRegs(&regs);
+			if (maxExtendedCode >= 0x80000022)
+				cpuid(0x80000022, &regs);
+			
+			printCpuInfoSupportedState("AMD PerfMonV2", regs.eax & 0x1);
+			if (regs.eax & 0x1)
+				printCpuInfoString("Core counters", extractBits(regs.ebx, 3, 0));
+		}
+		printf("\n");
+		return;
+	}
+	
+	printCpuInfoString("General-purpose counters", gpCounters);
+	printCpuInfoString("General-purpose counter width", gpWidth);
+	
+	// EBX bit set means the event is NOT available
+	const char* events[] = {
+		"Core cycles", "Instructions retired", "Reference cycles", "LLC references",
+		"LLC misses", "Branch instructions retired", "Branch mispredicts retired", "Top-down slots"
+	};
+	for (uint32_t i = 0; i < sizeof(events) / sizeof(events[0]); i++) {
+		char name[64];
+		snprintf(name, sizeof(name), "Event: %s", events[i]);
+		printCpuInfoSupportedState(name, i < eventVectorLength && !(unavailableEvents & (1U << i)));
+	}
+	
+	if (version > 1) {
+		printCpuInfoString("Fixed-function counters", fixedCounters);
+		printCpuInfoString("Fixed-function counter width", fixedWidth);
+	}
+	if (version >= 5)
+		printCpuInfoString("Fixed-function counter bitmap", fixedCounterMask);
+	printf("	AnyThread: %s\n", anyThreadDeprecated ? "Deprecated" : "Available");
+	printf("\n");
 }
 
 void dispCacheInfo() {
@@ -294,7 +425,58 @@ void dispCPUTopology() {
 }
 
 void dispPwrManPerf() {
+	cpuid_regs regs = {};
+	
+	// EAX = 0 ECX = 0
+	cpuid(0, &regs);
+	uint32_t maxFunctionCode = regs.eax;
+	
+	clearRegs(&regs);
 	
+	// EAX = 6 ECX = 0
+	if (maxFunctionCode >= 6)
+		cpuid(0x6, &regs);
+	uint32_t dts = (regs.eax & 0x1);
+	uint32_t turboBoost = (regs.eax & 0x2);
+	uint32_t arat = (regs.eax & 0x4);
+	uint32_t pln = (regs.eax & 0x10);
+	uint32_t ecmd = (regs.eax & 0x20);
+	uint32_t ptm = (regs.eax & 0x40);
+	uint32_t hwp = (regs.eax & 0x80);
+	uint32_t hwpNotify = (regs.eax & 0x100);
+	uint32_t hwpActivityWindow = (regs.eax & 0x200);
+	uint32_t hwpEpp = (regs.eax & 0x400);
+	uint32_t hwpPackage = (regs.eax & 0x800);
+	uint32_t hdc = (regs.eax & 0x2000);
+	uint32_t turboBoostMax = (regs.eax & 0x4000);
+	uint32_t hwpFastRequest = (regs.eax & 0x40000);
+	uint32_t hwFeedback = (regs.eax & 0x80000);
+	uint32_t threadDirector = (regs.eax & 0x800000);
+	uint32_t dtsThresholds = extractBits(regs.ebx, 3, 0);
+	uint32_t aperfMperf = (regs.ecx & 0x1);
+	uint32_t epb = (regs.ecx & 0x8);
+	
+	printf("POWER MANAGEMENT AND PERFORMANCE\n");
+	printCpuInfoSupportedState("Digital Thermal Sensor", dts);
+	printCpuInfoSupportedState("Turbo Boost", turboBoost);
+	printCpuInfoSupportedState("Turbo Boost Max 3.0", turboBoostMax);
+	printCpuInfoSupportedState("Always Running APIC Timer (ARAT)", arat);
+	printCpuInfoSupportedState("Power Limit Notification", pln);
+	printCpuInfoSupportedState("Clock Modulation Duty Cycle Extension", ecmd);
+	printCpuInfoSupportedState("Package Thermal Management", ptm);
+	printCpuInfoSupportedState("Hardware P-States (HWP)", hwp);
+	printCpuInfoSupportedState("HWP Notification", hwpNotify);
+	printCpuInfoSupportedState("HWP Activity Window", hwpActivityWindow);
+	printCpuInfoSupportedState("HWP Energy Performance Preference", hwpEpp);
+	printCpuInfoSupportedState("HWP Package Level Request", hwpPackage);
+	printCpuInfoSupportedState("HWP Fast Request MSR", hwpFastRequest);
+	printCpuInfoSupportedState("Hardware Duty Cycling", hdc);
+	printCpuInfoSupportedState("Hardware Feedback Interface", hwFeedback);
+	printCpuInfoSupportedState("Thread Director", threadDirector);
+	printCpuInfoSupportedState("APERF/MPERF Effective Frequency", aperfMperf);
+	printCpuInfoSupportedState("Energy Performance Bias", epb);
+	printCpuInfoString("DTS interrupt thresholds", dtsThresholds);
+	printf("\n");
 }
 
 void dispMultithreading() {
@@ -329,6 +511,11 @@ int main(int argc, char* argv[]) {
 	dispCPUIdentification();
 	dispCPUFeaturesBasic();
 	dispAVX512Features();
+	dispCPUFeaturesExtended();
+	dispSpinWaitFeatures();
+	dispFPControl();
+	dispPerfMonitoring();
+	dispPwrManPerf();
 	printf("Done.");
 	return 0;
 }
\ No newline at end of file
@@ -3,6 +3,17 @@
 #include <ctype.h>
 #include <string.h>
 
+// The benchmark and monitoring commands are Linux only; help and license build everywhere
+#if defined(__linux__)
+#include "spinbench.h"
+#include "denormbench.h"
+#include "rngbench.h"
+#include "perfstat.h"
+#include "freqwatch.h"
+#include "harness.h"
+#include "timing.h"
+#endif
+
 void toUpperCase(char* str) {
     while (*str) {
         *str = (unsigned char)toupper((unsigned int)*str);
@@ -15,17 +26,71 @@ void showHelp() {
 	printf("         - Copyright (c) Nathan Gill, under the Mozilla Public License v2.0.\n");
 	printf("USAGE\n");
 	printf("	CPUTOOLS [OPTIONS]\n");
+	printf("	CPUTOOLS <COMMAND> [ARGUMENTS]\n");
 	printf("DESCRIPTION\n");
 	printf("	OPTIONS\n");
 	printf("		One of the options below:\n");
 	printf("			-(h)elp    - Displays this message.\n");
 	printf("			-(l)icense - Displays license information.\n");
 	printf("			-?         - Displays this message.\n");
+#if defined(__linux__)
+	printf("	COMMANDS\n");
+	printf("		spin [PROFILE] - Calibrates spin-waiting: PAUSE latency, TPAUSE/UMWAIT/MWAITX\n");
+	printf("		                 wake-up latency and lock handoff latency per backoff strategy.\n");
+	printf("		                 Writes a spin budget, the futex park/wake latency, to PROFILE\n");
+	printf("		                 (default \"%s\").\n", SPIN_PROFILE_DEFAULT);
+	printf("		denormal       - Measures scalar, SSE, AVX and AVX-512 add/mul/FMA throughput on\n");
+	printf("		                 normal operands, subnormal inputs and subnormal results, with\n");
+	printf("		                 FTZ/DAZ on and off.\n");
+	printf("		rng            - Measures single-thread and all-core RDRAND/RDSEED throughput and\n");
+	printf("		                 failure rates, and the buffered hwRandomBytes API.\n");
+	printf("		stat -- <CMD>  - Runs CMD and reports cycles, instructions, IPC, cache and branch\n");
+	printf("		                 miss rates per logical CPU. Falls back to software events when\n");
+	printf("		                 hardware counters are unavailable.\n");
+	printf("		watch [INTERVAL MS] [SAMPLES] [CSV|JSON]\n");
+	printf("		               - Streams each core's effective frequency, busy time and thermal\n");
+	printf("		                 throttle events every INTERVAL MS (default %d). Uses APERF/MPERF\n", WATCH_INTERVAL_DEFAULT_MS);
+	printf("		                 through /dev/cpu/*/msr when permitted, a timed loop otherwise.\n");
+	printf("		bench [OUTPUT] [SAMPLES]\n");
+	printf("		               - Runs every benchmark through the common harness: pinned to one CPU,\n");
+	printf("		                 warmed up and started once the clock is stable. Cases are\n");
+	printf("		                 interleaved and every sample runs for at least 1 ms. Writes median,\n");
+	printf("		                 p99 (max below 100 samples) and MAD, the raw samples and a CPUID\n");
+	printf("		                 snapshot to OUTPUT (default \"%s\", %d samples, at least %d).\n", HARNESS_DEFAULT_OUTPUT, HARNESS_DEFAULT_SAMPLES, HARNESS_MIN_SAMPLES);
+	printf("		compare <BASELINE> <CANDIDATE> [THRESHOLD %%]\n");
+	printf("		               - Flags statistically significant changes between two bench result\n");
+	printf("		                 files that also exceed THRESHOLD (default %.0f%%) and the noise of\n", HARNESS_DEFAULT_THRESHOLD);
+	printf("		                 both runs. Exits with 2 when a regression is found or a baseline\n");
+	printf("		                 benchmark is missing from CANDIDATE, and with 3 when a benchmark is\n");
+	printf("		                 too noisy to resolve a THRESHOLD change.\n");
+#endif
 	printf("TOOLS\n");
 	printf("	CPUID - A command line wrapper for the CPUID instruction.\n");
 	printf("		Type \"CPUID --HELP\" for more information.\n");
 }
 
+#if defined(__linux__)
+int runBenchSuite(const char* outputPath, int samples) {
+	harness_case cases[HARNESS_MAX_CASES];
+	harness_options options = { 0, samples, HARNESS_DEFAULT_WARMUP };
+	int count = 0;
+
+	// Pin to the first CPU this process may use, which is not necessarily CPU 0
+	getCpuList(&options.cpu, 1);
+
+	if (samples < HARNESS_MIN_SAMPLES) {
+		printf("At least %d samples per benchmark are required!\n", HARNESS_MIN_SAMPLES);
+		return 1;
+	}
+
+	count += spinBenchCases(cases + count, HARNESS_MAX_CASES - count);
+	count += denormalBenchCases(cases + count, HARNESS_MAX_CASES - count);
+	count += rngBenchCases(cases + count, HARNESS_MAX_CASES - count);
+
+	return harnessRun(cases, count, &options, outputPath);
+}
+#endif
+
 void showLicense() {
 	FILE* f = fopen("LICENSE", "r");
 	if (!f) {
@@ -60,6 +125,39 @@ int main(int argc, char* argv[]) {
 			showLicense();
 			return 0;
 		}
+#if defined(__linux__)
+		else if (!strcmp(s, "SPIN")) {
+			return runSpinBench((i + 1 < argc) ? argv[i + 1] : SPIN_PROFILE_DEFAULT);
+		}
+		else if (!strcmp(s, "DENORMAL")) {
+			return runDenormalBench();
+		}
+		else if (!strcmp(s, "RNG")) {
+			return runRngBench();
+		}
+		else if (!strcmp(s, "STAT")) {
+			int first = i + 1;
+			if (first < argc && !strcmp(argv[first], "--"))
+				first++;
+			return runPerfStat(argc - first, argv + first);
+		}
+		else if (!strcmp(s, "WATCH")) {
+			return runFreqWatch(argc - i - 1, argv + i + 1);
+		}
+		else if (!strcmp(s, "BENCH")) {
+			const char* output = (i + 1 < argc) ? argv[i + 1] : HARNESS_DEFAULT_OUTPUT;
+			int samples = (i + 2 < argc) ? atoi(argv[i + 2]) : HARNESS_DEFAULT_SAMPLES;
+			return runBenchSuite(output, samples);
+		}
+		else if (!strcmp(s, "COMPARE")) {
+			if (i + 2 >= argc) {
+				printf("Usage: CPUTOOLS COMPARE <BASELINE> <CANDIDATE> [THRESHOLD %%]\n");
+				return 1;
+			}
+			double threshold = (i + 3 < argc) ? atof(argv[i + 3]) : HARNESS_DEFAULT_THRESHOLD;
+			return harnessCompare(argv[i + 1], argv[i + 2], threshold);
+		}
+#endif
 		else {
 			showHelp();
 			return 1;
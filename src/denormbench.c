@@ -0,0 +1,328 @@
+#if defined(__linux__)
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+#include <immintrin.h>
+
+#include "cpuid_ex.h"
+#include "timing.h"
+#include "harness.h"
+#include "denormbench.h"
+
+// Iterations per timed run; each iteration issues 2 instructions per accumulator
+#define KERNEL_ITERS 2000
+#define KERNEL_ACCS 8
+#define KERNEL_REPEATS 7
+#define KERNEL_INSTRUCTIONS (KERNEL_ITERS * 2 * KERNEL_ACCS)
+
+#define MXCSR_DAZ 0x40
+#define MXCSR_FTZ 0x8000
+
+#define OP_ADD 0
+#define OP_MUL 1
+#define OP_FMA 2
+#define OP_COUNT 3
+
+#define ISA_SCALAR 0
+#define ISA_SSE 1
+#define ISA_AVX 2
+#define ISA_AVX512 3
+#define ISA_COUNT 4
+
+#define MODE_OFF 0
+#define MODE_FTZ 1
+#define MODE_FTZ_DAZ 2
+#define MODE_COUNT 3
+
+// Normal operands and result, a subnormal input with a normal result, and
+// normal inputs whose result underflows to a subnormal
+#define KIND_NORMAL 0
+#define KIND_INPUT 1
+#define KIND_OUTPUT 2
+#define KIND_COUNT 3
+
+static const char* opNames[OP_COUNT] = { "add", "mul", "fma" };
+static const char* isaNames[ISA_COUNT] = { "Scalar", "SSE", "AVX", "AVX-512" };
+static const char* modeNames[MODE_COUNT] = { "off", "FTZ", "FTZ+DAZ" };
+static const uint32_t modeBits[MODE_COUNT] = { 0, MXCSR_FTZ, MXCSR_FTZ | MXCSR_DAZ };
+static const char* modeSuffixes[MODE_COUNT] = { "", ".ftz", ".ftz-daz" };
+static const char* kindNames[KIND_COUNT] = { "normal", "input", "output" };
+
+typedef struct {
+	float value;
+	float scale;
+} denormal_operands;
+
+// Each op computes value + scale, value * scale or value * scale + 0
+static const denormal_operands operandSets[OP_COUNT][KIND_COUNT] = {
+	{ { 0x1p-10f, 0x1p-10f }, { 0x1p-140f, 0x1p-120f }, { 0x1.8p-126f, -0x1p-126f } },
+	{ { 0x1p-10f, 0x1p-10f }, { 0x1p-140f, 0x1p100f }, { 0x1p-70f, 0x1p-70f } },
+	{ { 0x1p-10f, 0x1p-10f }, { 0x1p-140f, 0x1p100f }, { 0x1p-70f, 0x1p-70f } },
+};
+
+typedef uint64_t (*denormal_kernel)(int op, float value, float scale);
+
+typedef struct {
+	int isa[ISA_COUNT];
+	int fma;
+	int daz;
+} denormal_support;
+
+typedef struct {
+	denormal_kernel kernel;
+	int op;
+	denormal_operands operands;
+	uint32_t mxcsr;
+} denormal_case;
+
+// Normal operands run with flushing off only; flushing cannot change their timing
+#define HARNESS_KIND_CASES (1 + (KIND_COUNT - 1) * MODE_COUNT)
+
+static denormal_case harnessContexts[ISA_COUNT * OP_COUNT * HARNESS_KIND_CASES];
+
+// Results are stored here so the compiler cannot discard the accumulators
+static float kernelSink[KERNEL_ACCS][16];
+
+// Every op reads the same two operand registers, which are never written, so
+// each timed instruction sees the chosen input no matter what the MXCSR does
+// to the results. The empty asm claims to consume the result and modify x,
+// which keeps the compiler from hoisting or merging the ops without emitting
+// any instructions.
+#define KEEP(a) __asm__ volatile("" : "+v" (a))
+#define SINK(a) __asm__ volatile("" : "+v" (a), "+v" (x))
+#define STEP(f, a) a = f(x, k); SINK(a)
+#define STEP8(f) \
+	STEP(f, a0); STEP(f, a1); STEP(f, a2); STEP(f, a3); \
+	STEP(f, a4); STEP(f, a5); STEP(f, a6); STEP(f, a7)
+#define FSTEP(f, a) a = f(x, k, zero); SINK(a)
+#define FSTEP8(f) \
+	FSTEP(f, a0); FSTEP(f, a1); FSTEP(f, a2); FSTEP(f, a3); \
+	FSTEP(f, a4); FSTEP(f, a5); FSTEP(f, a6); FSTEP(f, a7)
+#define STORE8(store) \
+	store(kernelSink[0], a0); store(kernelSink[1], a1); store(kernelSink[2], a2); store(kernelSink[3], a3); \
+	store(kernelSink[4], a4); store(kernelSink[5], a5); store(kernelSink[6], a6); store(kernelSink[7], a7)
+
+#define KERNEL_SETUP(vec, set1) \
+	vec x = set1(value), k = set1(scale), zero = set1(0.0f); \
+	vec a0 = zero, a1 = zero, a2 = zero, a3 = zero; \
+	vec a4 = zero, a5 = zero, a6 = zero, a7 = zero; \
+	KEEP(x); KEEP(k); KEEP(zero)
+
+#define DENORMAL_KERNEL(name, isaTarget, vec, set1, add, mul, store) \
+__attribute__((target(isaTarget))) \
+static uint64_t name(int op, float value, float scale) { \
+	KERNEL_SETUP(vec, set1); \
+	uint64_t start = readTscOrdered(); \
+	if (op == OP_ADD) { \
+		for (int i = 0; i < KERNEL_ITERS; i++) { STEP8(add); STEP8(add); } \
+	} \
+	else { \
+		for (int i = 0; i < KERNEL_ITERS; i++) { STEP8(mul); STEP8(mul); } \
+	} \
+	uint64_t ticks = readTscOrdered() - start; \
+	STORE8(store); \
+	return ticks; \
+}
+
+#define DENORMAL_FMA_KERNEL(name, isaTarget, vec, set1, fmadd, store) \
+__attribute__((target(isaTarget))) \
+static uint64_t name(int op, float value, float scale) { \
+	KERNEL_SETUP(vec, set1); \
+	(void)op; \
+	uint64_t start = readTscOrdered(); \
+	for (int i = 0; i < KERNEL_ITERS; i++) { FSTEP8(fmadd); FSTEP8(fmadd); } \
+	uint64_t ticks = readTscOrdered() - start; \
+	STORE8(store); \
+	return ticks; \
+}
+
+DENORMAL_KERNEL(kernelScalar, "sse2", __m128, _mm_set_ss, _mm_add_ss, _mm_mul_ss, _mm_storeu_ps)
+DENORMAL_KERNEL(kernelSse, "sse2", __m128, _mm_set1_ps, _mm_add_ps, _mm_mul_ps, _mm_storeu_ps)
+DENORMAL_KERNEL(kernelAvx, "avx", __m256, _mm256_set1_ps, _mm256_add_ps, _mm256_mul_ps, _mm256_storeu_ps)
+DENORMAL_KERNEL(kernelAvx512, "avx512f", __m512, _mm512_set1_ps, _mm512_add_ps, _mm512_mul_ps, _mm512_storeu_ps)
+
+// FMA3 implies VEX encoding, so the scalar and SSE rows use 128-bit VEX forms
+DENORMAL_FMA_KERNEL(kernelScalarFma, "fma", __m128, _mm_set_ss, _mm_fmadd_ss, _mm_storeu_ps)
+DENORMAL_FMA_KERNEL(kernelSseFma, "fma", __m128, _mm_set1_ps, _mm_fmadd_ps, _mm_storeu_ps)
+DENORMAL_FMA_KERNEL(kernelAvxFma, "avx,fma", __m256, _mm256_set1_ps, _mm256_fmadd_ps, _mm256_storeu_ps)
+DENORMAL_FMA_KERNEL(kernelAvx512Fma, "avx512f", __m512, _mm512_set1_ps, _mm512_fmadd_ps, _mm512_storeu_ps)
+
+static const denormal_kernel kernels[ISA_COUNT] = { kernelScalar, kernelSse, kernelAvx, kernelAvx512 };
+static const denormal_kernel fmaKernels[ISA_COUNT] = { kernelScalarFma, kernelSseFma, kernelAvxFma, kernelAvx512Fma };
+
+static void detectSupport(denormal_support* support) {
+	cpuid_regs regs = {};
+	uint64_t xcr0 = 0;
+
+	cpuid(0, &regs);
+	uint32_t maxBasic = regs.eax;
+
+	cpuid(1, &regs);
+	uint32_t sse2 = (regs.edx & 0x4000000);
+	uint32_t osxsave = (regs.ecx & 0x8000000);
+	uint32_t avx = (regs.ecx & 0x10000000);
+	uint32_t fma = (regs.ecx & 0x1000);
+
+	uint32_t avx512f = 0;
+	if (maxBasic >= 7) {
+		cpuidex(7, 0, &regs);
+		avx512f = (regs.ebx & 0x10000);
+	}
+
+	// The OS must save the YMM (and for AVX-512, opmask and ZMM) state
+	if (osxsave)
+		xcr0 = xgetbv(0);
+	int avxState = ((xcr0 & 0x6) == 0x6);
+	int avx512State = ((xcr0 & 0xE6) == 0xE6);
+
+	support->isa[ISA_SCALAR] = (sse2 != 0);
+	support->isa[ISA_SSE] = (sse2 != 0);
+	support->isa[ISA_AVX] = (avx && avxState);
+	support->isa[ISA_AVX512] = (avx512f && avx512State);
+	support->fma = (fma && avxState);
+
+	uint32_t mxcsr, mask;
+	mxcsrinfo(&mxcsr, &mask);
+	support->daz = (mask & MXCSR_DAZ) ? 1 : 0;
+}
+
+static double timeKernel(denormal_kernel kernel, int op, const denormal_operands* operands, uint32_t mxcsr) {
+	uint64_t samples[KERNEL_REPEATS];
+	uint32_t saved = _mm_getcsr();
+
+	_mm_setcsr((saved & ~(MXCSR_FTZ | MXCSR_DAZ)) | mxcsr);
+
+	// One untimed run to settle caches and any AVX frequency transition
+	kernel(op, operands->value, operands->scale);
+	for (int i = 0; i < KERNEL_REPEATS; i++)
+		samples[i] = kernel(op, operands->value, operands->scale);
+
+	_mm_setcsr(saved);
+
+	qsort(samples, KERNEL_REPEATS, sizeof(uint64_t), harnessCompareU64);
+	return tscToNs(samples[KERNEL_REPEATS / 2]) / KERNEL_INSTRUCTIONS;
+}
+
+static double sampleKernel(void* context) {
+	denormal_case* c = (denormal_case*)context;
+	uint32_t saved = _mm_getcsr();
+
+	_mm_setcsr((saved & ~(MXCSR_FTZ | MXCSR_DAZ)) | c->mxcsr);
+	uint64_t ticks = c->kernel(c->op, c->operands.value, c->operands.scale);
+	_mm_setcsr(saved);
+
+	return tscToNs(ticks) / KERNEL_INSTRUCTIONS;
+}
+
+int denormalBenchCases(harness_case* cases, int max) {
+	denormal_support support = {};
+	int count = 0;
+
+	detectSupport(&support);
+	for (int isa = 0; isa < ISA_COUNT; isa++) {
+		if (!support.isa[isa])
+			continue;
+
+		for (int op = 0; op < OP_COUNT; op++) {
+			if (op == OP_FMA && !support.fma)
+				continue;
+
+			for (int kind = 0; kind < KIND_COUNT; kind++) {
+				for (int mode = 0; mode < MODE_COUNT && count < max; mode++) {
+					if (mode != MODE_OFF && (kind == KIND_NORMAL || ((modeBits[mode] & MXCSR_DAZ) && !support.daz)))
+						continue;
+
+					denormal_case* c = &harnessContexts[count];
+					c->kernel = (op == OP_FMA) ? fmaKernels[isa] : kernels[isa];
+					c->op = op;
+					c->operands = operandSets[op][kind];
+					c->mxcsr = modeBits[mode];
+
+					memset(&cases[count], 0, sizeof(harness_case));
+					snprintf(cases[count].name, sizeof(cases[count].name), "denormal.%s.%s.%s%s",
+						isaNames[isa], opNames[op], kindNames[kind], modeSuffixes[mode]);
+					cases[count].unit = "ns";
+					cases[count].lowerIsBetter = 1;
+					cases[count].sample = sampleKernel;
+					cases[count].context = c;
+					count++;
+				}
+			}
+		}
+	}
+
+	return count;
+}
+
+int runDenormalBench() {
+	denormal_support support = {};
+	double worst[ISA_COUNT][MODE_COUNT] = {};
+	uint32_t mxcsr, mask;
+	int cpu;
+
+	detectSupport(&support);
+	mxcsrinfo(&mxcsr, &mask);
+	getCpuList(&cpu, 1);
+	pinToCpu(cpu);
+	int stable = harnessWaitForStableClock();
+
+	printf("DENORMAL PERFORMANCE\n");
+	printf("	Clock stabilized: %s\n", stable ? "Yes" : "No, results may be noisy");
+	printf("	MXCSR: 0x%x, MXCSR mask: 0x%x\n", mxcsr, mask);
+	printf("	DAZ: %s\n", support.daz ? "Supported" : "Not supported");
+	printf("	FTZ state: %s, DAZ state: %s\n", (mxcsr & MXCSR_FTZ) ? "Enabled" : "Disabled", (mxcsr & MXCSR_DAZ) ? "Enabled" : "Disabled");
+	printf("	Single precision, ns per instruction (throughput, %d independent results):\n", KERNEL_ACCS);
+	printf("	Input: subnormal operand, normal result. Output: normal operands, subnormal result.\n");
+	printf("		%-8s %-4s %-8s %10s %10s %10s %8s %8s\n", "ISA", "Op", "Flush", "Normal", "Input", "Output", "Input x", "Output x");
+
+	for (int isa = 0; isa < ISA_COUNT; isa++) {
+		if (!support.isa[isa]) {
+			printf("		%-8s not supported by this CPU or OS, skipping.\n", isaNames[isa]);
+			continue;
+		}
+
+		for (int op = 0; op < OP_COUNT; op++) {
+			if (op == OP_FMA && !support.fma)
+				continue;
+			denormal_kernel kernel = (op == OP_FMA) ? fmaKernels[isa] : kernels[isa];
+
+			for (int mode = 0; mode < MODE_COUNT; mode++) {
+				if ((modeBits[mode] & MXCSR_DAZ) && !support.daz)
+					continue;
+
+				double ns[KIND_COUNT];
+				double slowdown[KIND_COUNT] = {};
+				for (int kind = 0; kind < KIND_COUNT; kind++) {
+					ns[kind] = timeKernel(kernel, op, &operandSets[op][kind], modeBits[mode]);
+					slowdown[kind] = (ns[KIND_NORMAL] > 0.0) ? ns[kind] / ns[KIND_NORMAL] : 0.0;
+					if (slowdown[kind] > worst[isa][mode])
+						worst[isa][mode] = slowdown[kind];
+				}
+
+				printf("		%-8s %-4s %-8s %10.3f %10.3f %10.3f %7.1fx %7.1fx\n", isaNames[isa], opNames[op], modeNames[mode],
+					ns[KIND_NORMAL], ns[KIND_INPUT], ns[KIND_OUTPUT], slowdown[KIND_INPUT], slowdown[KIND_OUTPUT]);
+			}
+		}
+	}
+
+	printf("	Worst subnormal slowdown per ISA level:\n");
+	for (int isa = 0; isa < ISA_COUNT; isa++) {
+		if (!support.isa[isa])
+			continue;
+		printf("		%-8s", isaNames[isa]);
+		for (int mode = 0; mode < MODE_COUNT; mode++) {
+			if ((modeBits[mode] & MXCSR_DAZ) && !support.daz)
+				continue;
+			printf(" %s: %6.1fx", modeNames[mode], worst[isa][mode]);
+		}
+		printf("\n");
+	}
+
+	return 0;
+}
+
+#endif
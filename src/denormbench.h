@@ -0,0 +1,18 @@
+#ifndef DENORMBENCH_H
+
+#define DENORMBENCH_H
+
+#include "harness.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+int runDenormalBench();
+int denormalBenchCases(harness_case* cases, int max);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
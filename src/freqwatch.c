@@ -0,0 +1,386 @@
+#if defined(__linux__)
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <strings.h>
+#include <stdlib.h>
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "cpuid_ex.h"
+#include "timing.h"
+#include "freqwatch.h"
+
+#define MSR_MPERF 0xE7
+#define MSR_APERF 0xE8
+
+// Samples buffered per core between writer wake-ups; must be a power of two
+#define WATCH_RING_SIZE 64
+
+#define WATCH_INTERVAL_MIN_MS 10
+
+// Target length of one fallback timing loop, in nanoseconds
+#define WATCH_LOOP_NS 50000.0
+
+// Dependent register adds per fallback loop iteration; each takes one core cycle.
+// Adds of an immediate are avoided because newer cores fold those at rename.
+#define WATCH_LOOP_CHAIN 8
+
+#define SOURCE_APERF 0
+#define SOURCE_LOOP 1
+
+#define FORMAT_CSV 0
+#define FORMAT_JSON 1
+
+static const char* sourceNames[] = { "aperf", "loop" };
+
+typedef struct {
+	uint64_t timestampNs;
+	int cpu;
+	int source;
+	double mhz;
+	double busy;
+	int64_t throttle;
+} watch_sample;
+
+// Single-producer, single-consumer ring: the sampler owns head, the writer owns tail
+typedef struct {
+	watch_sample slots[WATCH_RING_SIZE];
+	volatile uint32_t head __attribute__((aligned(64)));
+	volatile uint32_t tail __attribute__((aligned(64)));
+	uint64_t dropped;
+} watch_ring;
+
+typedef struct {
+	int cpu;
+	int useMsr;
+	uint64_t intervalNs;
+	uint64_t startNs;
+	uint32_t samples;
+	watch_ring* ring;
+	pthread_t thread;
+} watch_sampler;
+
+static volatile sig_atomic_t stopRequested = 0;
+
+static void handleStop(int sig) {
+	(void)sig;
+	stopRequested = 1;
+}
+
+static int ringPush(watch_ring* ring, const watch_sample* sample) {
+	uint32_t head = ring->head;
+	uint32_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+
+	if (head - tail == WATCH_RING_SIZE) {
+		ring->dropped++;
+		return 0;
+	}
+
+	ring->slots[head & (WATCH_RING_SIZE - 1)] = *sample;
+	__atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+	return 1;
+}
+
+static int ringPop(watch_ring* ring, watch_sample* sample) {
+	uint32_t tail = ring->tail;
+	uint32_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+
+	if (head == tail)
+		return 0;
+
+	*sample = ring->slots[tail & (WATCH_RING_SIZE - 1)];
+	__atomic_store_n(&ring->tail, tail + 1, __ATOMIC_RELEASE);
+	return 1;
+}
+
+static int readMsr(int fd, uint32_t reg, uint64_t* value) {
+	return pread(fd, value, sizeof(*value), reg) == sizeof(*value);
+}
+
+static int64_t readThrottleCount(int cpu) {
+	char path[96];
+	long long count = -1;
+
+	snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/thermal_throttle/core_throttle_count", cpu);
+	FILE* f = fopen(path, "r");
+	if (f) {
+		if (fscanf(f, "%lld", &count) != 1)
+			count = -1;
+		fclose(f);
+	}
+
+	return count;
+}
+
+static uint64_t runChain(uint64_t iterations) {
+	uint64_t x = 0;
+
+	for (uint64_t i = 0; i < iterations; i++) {
+		__asm__ volatile(
+			"add %0, %0\n\tadd %0, %0\n\tadd %0, %0\n\tadd %0, %0\n\t"
+			"add %0, %0\n\tadd %0, %0\n\tadd %0, %0\n\tadd %0, %0"
+			: "+r" (x));
+	}
+
+	return x;
+}
+
+static uint64_t calibrateChain() {
+	// Size the loop so one measurement costs about WATCH_LOOP_NS at the current clock
+	uint64_t probe = 1000;
+	uint64_t start = nowNs();
+	runChain(probe);
+	uint64_t elapsed = nowNs() - start;
+
+	if (elapsed == 0)
+		elapsed = 1;
+	uint64_t iterations = (uint64_t)((double)probe * WATCH_LOOP_NS / (double)elapsed);
+	return (iterations < probe) ? probe : iterations;
+}
+
+static void sleepUntil(uint64_t deadlineNs) {
+	struct timespec ts;
+	ts.tv_sec = (time_t)(deadlineNs / 1000000000ULL);
+	ts.tv_nsec = (long)(deadlineNs % 1000000000ULL);
+
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR && !stopRequested)
+		;
+}
+
+static void* samplerMain(void* arg) {
+	watch_sampler* s = (watch_sampler*)arg;
+	double tscHz = getTscHz();
+	int msr = -1;
+	uint64_t lastAperf = 0, lastMperf = 0, lastTsc = 0;
+	int64_t lastThrottle;
+	uint64_t chain = 0;
+
+	pinToCpu(s->cpu);
+
+	if (s->useMsr) {
+		char path[64];
+		snprintf(path, sizeof(path), "/dev/cpu/%d/msr", s->cpu);
+		msr = open(path, O_RDONLY);
+		if (msr >= 0 && (!readMsr(msr, MSR_APERF, &lastAperf) || !readMsr(msr, MSR_MPERF, &lastMperf))) {
+			close(msr);
+			msr = -1;
+		}
+		lastTsc = readTsc();
+	}
+	if (msr < 0)
+		chain = calibrateChain();
+	lastThrottle = readThrottleCount(s->cpu);
+
+	for (uint32_t n = 1; !stopRequested && (s->samples == 0 || n <= s->samples); n++) {
+		sleepUntil(s->startNs + n * s->intervalNs);
+		if (stopRequested)
+			break;
+
+		watch_sample sample = {};
+		sample.cpu = s->cpu;
+		sample.timestampNs = nowNs();
+		sample.busy = -1.0;
+
+		if (msr >= 0) {
+			uint64_t aperf = 0, mperf = 0;
+			uint64_t tsc = readTsc();
+			readMsr(msr, MSR_APERF, &aperf);
+			readMsr(msr, MSR_MPERF, &mperf);
+
+			// MPERF ticks at the TSC rate while the core is in C0, APERF at the actual clock
+			uint64_t deltaAperf = aperf - lastAperf;
+			uint64_t deltaMperf = mperf - lastMperf;
+			sample.source = SOURCE_APERF;
+			sample.mhz = deltaMperf ? tscHz * (double)deltaAperf / (double)deltaMperf / 1e6 : 0.0;
+			sample.busy = (tsc > lastTsc) ? 100.0 * (double)deltaMperf / (double)(tsc - lastTsc) : 0.0;
+
+			lastAperf = aperf;
+			lastMperf = mperf;
+			lastTsc = tsc;
+		}
+		else {
+			uint64_t start = nowNs();
+			runChain(chain);
+			uint64_t elapsed = nowNs() - start;
+
+			sample.source = SOURCE_LOOP;
+			sample.mhz = elapsed ? (double)(chain * WATCH_LOOP_CHAIN) * 1e3 / (double)elapsed : 0.0;
+		}
+
+		int64_t throttle = readThrottleCount(s->cpu);
+		sample.throttle = (throttle >= 0 && lastThrottle >= 0) ? throttle - lastThrottle : -1;
+		lastThrottle = throttle;
+
+		ringPush(s->ring, &sample);
+	}
+
+	if (msr >= 0)
+		close(msr);
+	return NULL;
+}
+
+static void emitSample(const watch_sample* sample, int format) {
+	if (format == FORMAT_JSON) {
+		printf("{\"timestamp_ns\":%llu,\"cpu\":%d,\"source\":\"%s\",\"mhz\":%.1f,",
+			(unsigned long long)sample->timestampNs, sample->cpu, sourceNames[sample->source], sample->mhz);
+		if (sample->busy >= 0.0)
+			printf("\"busy_pct\":%.1f,", sample->busy);
+		else
+			printf("\"busy_pct\":null,");
+		if (sample->throttle >= 0)
+			printf("\"throttle_events\":%lld}\n", (long long)sample->throttle);
+		else
+			printf("\"throttle_events\":null}\n");
+		return;
+	}
+
+	printf("%llu,%d,%s,%.1f,", (unsigned long long)sample->timestampNs, sample->cpu, sourceNames[sample->source], sample->mhz);
+	if (sample->busy >= 0.0)
+		printf("%.1f", sample->busy);
+	printf(",");
+	if (sample->throttle >= 0)
+		printf("%lld", (long long)sample->throttle);
+	printf("\n");
+}
+
+static int drainRings(watch_sampler* samplers, int cpus, int format) {
+	watch_sample sample;
+	int emitted = 0;
+
+	for (int i = 0; i < cpus; i++) {
+		while (ringPop(samplers[i].ring, &sample)) {
+			emitSample(&sample, format);
+			emitted++;
+		}
+	}
+
+	if (emitted)
+		fflush(stdout);
+	return emitted;
+}
+
+static int isNumber(const char* s) {
+	if (!*s)
+		return 0;
+	while (*s) {
+		if (!isdigit((unsigned char)*s))
+			return 0;
+		s++;
+	}
+	return 1;
+}
+
+int runFreqWatch(int argc, char* argv[]) {
+	uint64_t intervalMs = WATCH_INTERVAL_DEFAULT_MS;
+	uint32_t samples = 0;
+	int format = FORMAT_CSV;
+	int numbers = 0;
+
+	// [INTERVAL MS] [SAMPLES] [CSV|JSON], in any order
+	for (int i = 0; i < argc; i++) {
+		if (!strcasecmp(argv[i], "CSV")) {
+			format = FORMAT_CSV;
+		}
+		else if (!strcasecmp(argv[i], "JSON")) {
+			format = FORMAT_JSON;
+		}
+		else if (isNumber(argv[i]) && numbers == 0) {
+			intervalMs = strtoull(argv[i], NULL, 10);
+			numbers++;
+		}
+		else if (isNumber(argv[i]) && numbers == 1) {
+			samples = (uint32_t)strtoul(argv[i], NULL, 10);
+			numbers++;
+		}
+		else {
+			printf("Unknown watch argument \"%s\"!\n", argv[i]);
+			return 1;
+		}
+	}
+
+	if (intervalMs < WATCH_INTERVAL_MIN_MS) {
+		printf("Sampling interval must be at least %d ms!\n", WATCH_INTERVAL_MIN_MS);
+		return 1;
+	}
+
+	cpuid_regs regs = {};
+	cpuid(0, &regs);
+	uint32_t maxBasic = regs.eax;
+	int aperfMperf = 0;
+	if (maxBasic >= 6) {
+		cpuid(6, &regs);
+		aperfMperf = (regs.ecx & 0x1) ? 1 : 0;
+	}
+
+	// Calibrate once before the samplers start so they share the result
+	getTscHz();
+
+	int cpuList[TIMING_MAX_CPUS];
+	int cpus = getCpuList(cpuList, TIMING_MAX_CPUS);
+	watch_sampler* samplers = calloc((size_t)cpus, sizeof(watch_sampler));
+	if (!samplers)
+		return 1;
+
+	struct sigaction action;
+	memset(&action, 0, sizeof(action));
+	action.sa_handler = handleStop;
+	sigaction(SIGINT, &action, NULL);
+	sigaction(SIGTERM, &action, NULL);
+
+	if (format == FORMAT_CSV)
+		printf("timestamp_ns,cpu,source,mhz,busy_pct,throttle_events\n");
+	fflush(stdout);
+
+	uint64_t intervalNs = intervalMs * 1000000ULL;
+	uint64_t startNs = nowNs();
+	int started = 0;
+	for (int i = 0; i < cpus; i++) {
+		samplers[i].cpu = cpuList[i];
+		samplers[i].useMsr = aperfMperf;
+		samplers[i].intervalNs = intervalNs;
+		samplers[i].startNs = startNs;
+		samplers[i].samples = samples;
+		samplers[i].ring = aligned_alloc(64, sizeof(watch_ring));
+		if (!samplers[i].ring)
+			break;
+		memset(samplers[i].ring, 0, sizeof(watch_ring));
+		if (pthread_create(&samplers[i].thread, NULL, samplerMain, &samplers[i]) != 0) {
+			free(samplers[i].ring);
+			break;
+		}
+		started++;
+	}
+
+	// The writer wakes half an interval after the samplers so their rows are ready
+	for (uint32_t n = 1; !stopRequested && (samples == 0 || n <= samples); n++) {
+		sleepUntil(startNs + n * intervalNs + intervalNs / 2);
+		drainRings(samplers, started, format);
+	}
+
+	stopRequested = 1;
+	for (int i = 0; i < started; i++)
+		pthread_join(samplers[i].thread, NULL);
+	drainRings(samplers, started, format);
+
+	uint64_t dropped = 0;
+	for (int i = 0; i < started; i++) {
+		dropped += samplers[i].ring->dropped;
+		free(samplers[i].ring);
+	}
+	if (dropped)
+		fprintf(stderr, "Dropped %llu samples; the output is not keeping up.\n", (unsigned long long)dropped);
+
+	free(samplers);
+	return 0;
+}
+
+#endif
@@ -0,0 +1,17 @@
+#ifndef FREQWATCH_H
+
+#define FREQWATCH_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define WATCH_INTERVAL_DEFAULT_MS 1000
+
+int runFreqWatch(int argc, char* argv[]);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,601 @@
+#if defined(__linux__)
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+#include <math.h>
+#include <time.h>
+#include <sys/utsname.h>
+
+#include "cpuid_ex.h"
+#include "timing.h"
+#include "harness.h"
+
+#define HARNESS_FORMAT_VERSION 1
+
+// Clock stabilization: consecutive probe timings must agree within this fraction
+#define HARNESS_STABLE_TOLERANCE 0.01
+#define HARNESS_STABLE_RUNS 3
+#define HARNESS_STABLE_TIMEOUT_NS 2000000000ULL
+#define HARNESS_PROBE_ITERATIONS 200000
+
+// Below this many samples the 99th percentile is simply the slowest sample
+#define HARNESS_P99_MIN_SAMPLES 100
+
+// Each sample repeats its case until it covers at least this long, in nanoseconds
+#define HARNESS_MIN_SAMPLE_NS 1000000ULL
+#define HARNESS_MAX_REPEATS 1000000
+#define HARNESS_CALIBRATION_RUNS 3
+
+// Significance level for the Mann-Whitney U test in compare
+#define HARNESS_ALPHA 0.01
+
+// A change must also exceed this many MADs, relative to the median, of the noisier run
+#define HARNESS_NOISE_MADS 5.0
+
+// Sub-leaves dumped for each indexed CPUID leaf; all-zero entries are skipped
+#define HARNESS_MAX_SUBLEAVES 32
+#define HARNESS_MAX_EXTENDED 0x40
+
+typedef struct {
+	uint32_t leaf;
+	uint32_t subleaf;
+	uint32_t regs[4];
+} cpuid_entry;
+
+typedef struct {
+	char name[64];
+	char unit[16];
+	int lowerIsBetter;
+	int count;
+	double* samples;
+} harness_result;
+
+typedef struct {
+	harness_result results[HARNESS_MAX_CASES];
+	int resultCount;
+	cpuid_entry* cpuid;
+	int cpuidCount;
+	int cpuidCapacity;
+} harness_file;
+
+static const uint32_t indexedLeaves[] = { 0x4, 0x7, 0xB, 0xD, 0xF, 0x10, 0x12, 0x14, 0x17, 0x18, 0x1D, 0x1E, 0x1F, 0x20, 0x23, 0x24 };
+
+int harnessCompareU64(const void* a, const void* b) {
+	uint64_t x = *(const uint64_t*)a;
+	uint64_t y = *(const uint64_t*)b;
+	return (x > y) - (x < y);
+}
+
+static int compareDouble(const void* a, const void* b) {
+	double x = *(const double*)a;
+	double y = *(const double*)b;
+	return (x > y) - (x < y);
+}
+
+uint64_t harnessPercentileU64(const uint64_t* sorted, uint32_t count, double p) {
+	if (count == 0)
+		return 0;
+	uint32_t index = (uint32_t)(p * (double)(count - 1) + 0.5);
+	return sorted[index];
+}
+
+static double percentileDouble(const double* sorted, int count, double p) {
+	if (count == 0)
+		return 0.0;
+	int index = (int)(p * (double)(count - 1) + 0.5);
+	return sorted[index];
+}
+
+void harnessStats(double* samples, int count, harness_stats* stats) {
+	memset(stats, 0, sizeof(*stats));
+	if (count <= 0)
+		return;
+
+	qsort(samples, (size_t)count, sizeof(double), compareDouble);
+	stats->median = percentileDouble(samples, count, 0.5);
+	stats->p99 = percentileDouble(samples, count, 0.99);
+	stats->min = samples[0];
+	stats->max = samples[count - 1];
+
+	double sum = 0.0;
+	double* deviations = malloc((size_t)count * sizeof(double));
+	for (int i = 0; i < count; i++) {
+		sum += samples[i];
+		if (deviations)
+			deviations[i] = fabs(samples[i] - stats->median);
+	}
+	stats->mean = sum / count;
+
+	// Median absolute deviation, a spread estimate that ignores outliers
+	if (deviations) {
+		qsort(deviations, (size_t)count, sizeof(double), compareDouble);
+		stats->mad = percentileDouble(deviations, count, 0.5);
+		free(deviations);
+	}
+}
+
+int harnessInvariantTsc() {
+	cpuid_regs regs = {};
+
+	cpuid(0x80000000, &regs);
+	if (regs.eax < 0x80000007)
+		return 0;
+
+	cpuid(0x80000007, &regs);
+	return (regs.edx & 0x100) ? 1 : 0;
+}
+
+static uint64_t timeProbe() {
+	uint64_t x = 1;
+	uint64_t start = readTscOrdered();
+
+	for (int i = 0; i < HARNESS_PROBE_ITERATIONS; i++)
+		__asm__ volatile("add %0, %0\n\tadd %0, %0\n\tadd %0, %0\n\tadd %0, %0" : "+r" (x));
+
+	return readTscOrdered() - start;
+}
+
+int harnessWaitForStableClock() {
+	// With an invariant TSC a fixed dependent chain takes a constant number of
+	// TSC ticks only once the core clock has stopped ramping
+	uint64_t deadline = nowNs() + HARNESS_STABLE_TIMEOUT_NS;
+	uint64_t previous = timeProbe();
+	int agreeing = 0;
+
+	while (nowNs() < deadline) {
+		uint64_t current = timeProbe();
+		double change = fabs((double)current - (double)previous) / (double)previous;
+
+		agreeing = (change <= HARNESS_STABLE_TOLERANCE) ? agreeing + 1 : 0;
+		if (agreeing >= HARNESS_STABLE_RUNS)
+			return 1;
+		previous = current;
+	}
+
+	return 0;
+}
+
+static int calibrateRepeats(const harness_case* c) {
+	// Use the fastest probe so the repeated sample never falls short of the minimum
+	uint64_t fastest = UINT64_MAX;
+
+	for (int i = 0; i < HARNESS_CALIBRATION_RUNS; i++) {
+		uint64_t start = nowNs();
+		c->sample(c->context);
+		uint64_t elapsed = nowNs() - start;
+		if (elapsed < fastest)
+			fastest = elapsed;
+	}
+
+	if (fastest == 0)
+		fastest = 1;
+	uint64_t repeats = (HARNESS_MIN_SAMPLE_NS + fastest - 1) / fastest;
+	return (repeats > HARNESS_MAX_REPEATS) ? HARNESS_MAX_REPEATS : (int)repeats;
+}
+
+static double sampleRepeated(const harness_case* c, int repeats) {
+	// Cases report a per-operation figure, so averaging keeps the unit
+	double sum = 0.0;
+
+	for (int i = 0; i < repeats; i++)
+		sum += c->sample(c->context);
+	return sum / repeats;
+}
+
+static void snapshotCpuid(FILE* f) {
+	cpuid_regs regs = {};
+
+	cpuid(0, &regs);
+	uint32_t maxBasic = regs.eax;
+	cpuid(0x80000000, &regs);
+	uint32_t maxExtended = regs.eax;
+	if (maxExtended > 0x80000000 + HARNESS_MAX_EXTENDED)
+		maxExtended = 0x80000000 + HARNESS_MAX_EXTENDED;
+
+	for (uint32_t leaf = 0; leaf <= maxBasic; leaf++) {
+		int subleaves = 1;
+		for (size_t i = 0; i < sizeof(indexedLeaves) / sizeof(indexedLeaves[0]); i++) {
+			if (indexedLeaves[i] == leaf)
+				subleaves = HARNESS_MAX_SUBLEAVES;
+		}
+
+		for (int sub = 0; sub < subleaves; sub++) {
+			cpuidex(leaf, (uint32_t)sub, &regs);
+			if (sub > 0 && !regs.eax && !regs.ebx && !regs.ecx && !regs.edx)
+				continue;
+			fprintf(f, "cpuid %08x %08x %08x %08x %08x %08x\n", leaf, sub, regs.eax, regs.ebx, regs.ecx, regs.edx);
+		}
+	}
+
+	for (uint32_t leaf = 0x80000000; leaf <= maxExtended; leaf++) {
+		cpuidex(leaf, 0, &regs);
+		fprintf(f, "cpuid %08x %08x %08x %08x %08x %08x\n", leaf, 0, regs.eax, regs.ebx, regs.ecx, regs.edx);
+	}
+}
+
+static void writeHeader(FILE* f, const harness_options* options, int invariantTsc, int stable) {
+	struct utsname host;
+	cpuid_regs regs = {};
+	char brand[49] = {};
+
+	for (uint32_t i = 0; i < 3; i++) {
+		cpuid(0x80000002 + i, &regs);
+		memcpy(brand + i * 16, &regs, 16);
+	}
+
+	fprintf(f, "# CPUTOOLS benchmark results\n");
+	fprintf(f, "version=%d\n", HARNESS_FORMAT_VERSION);
+	fprintf(f, "timestamp=%lld\n", (long long)time(NULL));
+	if (uname(&host) == 0)
+		fprintf(f, "kernel=%s %s\n", host.sysname, host.release);
+	fprintf(f, "brand=%s\n", brand);
+	fprintf(f, "cpu=%d\n", options->cpu);
+	fprintf(f, "samples=%d\n", options->samples);
+	fprintf(f, "min_sample_ns=%llu\n", (unsigned long long)HARNESS_MIN_SAMPLE_NS);
+	fprintf(f, "tsc_hz=%.0f\n", getTscHz());
+	fprintf(f, "invariant_tsc=%d\n", invariantTsc);
+	fprintf(f, "clock_stable=%d\n", stable);
+	snapshotCpuid(f);
+}
+
+int harnessRun(const harness_case* cases, int count, const harness_options* options, const char* outputPath) {
+	FILE* f = fopen(outputPath, "w");
+	if (!f) {
+		printf("Unable to write benchmark results \"%s\"!\n", outputPath);
+		return 1;
+	}
+
+	double* samples = malloc((size_t)count * options->samples * sizeof(double));
+	int* repeats = malloc((size_t)count * sizeof(int));
+	if (!samples || !repeats) {
+		free(samples);
+		free(repeats);
+		fclose(f);
+		return 1;
+	}
+
+	if (pinToCpu(options->cpu) != 0)
+		printf("Warning: unable to pin to CPU %d, results may be noisy.\n", options->cpu);
+
+	int invariantTsc = harnessInvariantTsc();
+	getTscHz();
+	int stable = harnessWaitForStableClock();
+
+	printf("BENCHMARK HARNESS\n");
+	printf("	CPU: %d, samples: %d, warm-up runs: %d\n", options->cpu, options->samples, options->warmup);
+	printf("	Invariant TSC: %s\n", invariantTsc ? "Supported" : "Not supported, TSC timings may drift with frequency");
+	printf("	Clock stabilized: %s\n", stable ? "Yes" : "No, results may be noisy");
+
+	writeHeader(f, options, invariantTsc, stable);
+
+	for (int c = 0; c < count; c++) {
+		for (int i = 0; i < options->warmup; i++)
+			cases[c].sample(cases[c].context);
+		repeats[c] = calibrateRepeats(&cases[c]);
+	}
+
+	// Back-to-back samples of one case share whatever state the machine was in at the
+	// time, which makes them look far more consistent than two runs are. Each pass takes
+	// one sample of every case, so slow drift lands in every case's spread instead.
+	printf("	Minimum sample length: %.1f ms, cases interleaved in %d passes\n", HARNESS_MIN_SAMPLE_NS / 1e6, options->samples);
+	for (int i = 0; i < options->samples; i++) {
+		for (int c = 0; c < count; c++)
+			samples[(size_t)c * options->samples + i] = sampleRepeated(&cases[c], repeats[c]);
+	}
+
+	const char* tailLabel = (options->samples >= HARNESS_P99_MIN_SAMPLES) ? "p99" : "max";
+	printf("		%-40s %8s %12s %12s %10s %6s\n", "Benchmark", "Repeats", "Median", tailLabel, "MAD", "Unit");
+	for (int c = 0; c < count; c++) {
+		double* caseSamples = samples + (size_t)c * options->samples;
+		harness_stats stats;
+
+		// Raw samples are written before harnessStats sorts them
+		fprintf(f, "result %s %s %s %d", cases[c].name, cases[c].unit, cases[c].lowerIsBetter ? "lower" : "higher", options->samples);
+		for (int i = 0; i < options->samples; i++)
+			fprintf(f, " %.6g", caseSamples[i]);
+		fprintf(f, "\n");
+
+		harnessStats(caseSamples, options->samples, &stats);
+		printf("		%-40s %8d %12.4g %12.4g %10.3g %6s\n", cases[c].name, repeats[c], stats.median,
+			(options->samples >= HARNESS_P99_MIN_SAMPLES) ? stats.p99 : stats.max, stats.mad, cases[c].unit);
+	}
+
+	free(samples);
+	free(repeats);
+	fclose(f);
+	printf("Results written to \"%s\".\n", outputPath);
+	return 0;
+}
+
+static void freeFile(harness_file* file) {
+	for (int i = 0; i < file->resultCount; i++)
+		free(file->results[i].samples);
+	free(file->cpuid);
+	memset(file, 0, sizeof(*file));
+}
+
+static int parseResult(const char* line, harness_result* result) {
+	char direction[16];
+	int offset = 0;
+
+	memset(result, 0, sizeof(*result));
+	if (sscanf(line, "result %63s %15s %15s %d%n", result->name, result->unit, direction, &result->count, &offset) != 4)
+		return 0;
+	if (result->count <= 0)
+		return 0;
+
+	result->lowerIsBetter = strcmp(direction, "higher") != 0;
+	result->samples = malloc((size_t)result->count * sizeof(double));
+	if (!result->samples)
+		return 0;
+
+	const char* p = line + offset;
+	for (int i = 0; i < result->count; i++) {
+		char* end;
+		result->samples[i] = strtod(p, &end);
+		if (end == p) {
+			result->count = i;
+			break;
+		}
+		p = end;
+	}
+
+	return result->count > 0;
+}
+
+static int loadFile(const char* path, harness_file* file) {
+	FILE* f = fopen(path, "r");
+	char* line = NULL;
+	size_t capacity = 0;
+
+	memset(file, 0, sizeof(*file));
+	if (!f) {
+		printf("Unable to open benchmark results \"%s\"!\n", path);
+		return 0;
+	}
+
+	while (getline(&line, &capacity, f) > 0) {
+		if (!strncmp(line, "result ", 7) && file->resultCount < HARNESS_MAX_CASES) {
+			if (parseResult(line, &file->results[file->resultCount]))
+				file->resultCount++;
+		}
+		else if (!strncmp(line, "cpuid ", 6)) {
+			cpuid_entry e;
+			if (sscanf(line, "cpuid %x %x %x %x %x %x", &e.leaf, &e.subleaf, &e.regs[0], &e.regs[1], &e.regs[2], &e.regs[3]) != 6)
+				continue;
+			if (file->cpuidCount == file->cpuidCapacity) {
+				int capacityNew = file->cpuidCapacity ? file->cpuidCapacity * 2 : 64;
+				cpuid_entry* grown = realloc(file->cpuid, (size_t)capacityNew * sizeof(cpuid_entry));
+				if (!grown)
+					continue;
+				file->cpuid = grown;
+				file->cpuidCapacity = capacityNew;
+			}
+			file->cpuid[file->cpuidCount++] = e;
+		}
+	}
+
+	free(line);
+	fclose(f);
+	return 1;
+}
+
+static void maskVolatileCpuid(cpuid_entry* e) {
+	// APIC IDs depend on which CPU ran the snapshot, not on the platform
+	if (e->leaf == 0x1)
+		e->regs[1] &= 0x00FFFFFF;
+	if (e->leaf == 0xB || e->leaf == 0x1F)
+		e->regs[3] = 0;
+}
+
+static int diffCpuid(harness_file* baseline, harness_file* candidate) {
+	int differences = 0;
+
+	for (int i = 0; i < candidate->cpuidCount; i++) {
+		cpuid_entry c = candidate->cpuid[i];
+		int found = 0;
+
+		maskVolatileCpuid(&c);
+		for (int j = 0; j < baseline->cpuidCount; j++) {
+			cpuid_entry b = baseline->cpuid[j];
+			if (b.leaf != c.leaf || b.subleaf != c.subleaf)
+				continue;
+
+			found = 1;
+			maskVolatileCpuid(&b);
+			if (memcmp(b.regs, c.regs, sizeof(b.regs))) {
+				printf("		Leaf 0x%08x.%x: %08x %08x %08x %08x -> %08x %08x %08x %08x\n", c.leaf, c.subleaf,
+					b.regs[0], b.regs[1], b.regs[2], b.regs[3], c.regs[0], c.regs[1], c.regs[2], c.regs[3]);
+				differences++;
+			}
+			break;
+		}
+
+		if (!found) {
+			printf("		Leaf 0x%08x.%x: only in candidate\n", c.leaf, c.subleaf);
+			differences++;
+		}
+	}
+
+	// Leaves that disappeared, e.g. after a microcode update hid a feature
+	for (int i = 0; i < baseline->cpuidCount; i++) {
+		cpuid_entry b = baseline->cpuid[i];
+		int found = 0;
+
+		for (int j = 0; j < candidate->cpuidCount && !found; j++)
+			found = (candidate->cpuid[j].leaf == b.leaf && candidate->cpuid[j].subleaf == b.subleaf);
+
+		if (!found) {
+			printf("		Leaf 0x%08x.%x: only in baseline\n", b.leaf, b.subleaf);
+			differences++;
+		}
+	}
+
+	return differences;
+}
+
+static double relativeMad(const harness_stats* stats) {
+	return (stats->median != 0.0) ? 100.0 * stats->mad / fabs(stats->median) : 0.0;
+}
+
+static double mannWhitneyP(const double* a, int n1, const double* b, int n2) {
+	// Two-sided p-value from the normal approximation, with tie correction
+	int n = n1 + n2;
+	double* values = malloc((size_t)n * sizeof(double));
+	int* fromA = malloc((size_t)n * sizeof(int));
+	if (!values || !fromA) {
+		free(values);
+		free(fromA);
+		return 1.0;
+	}
+
+	// Sort the pooled samples, remembering which set each came from
+	for (int i = 0; i < n; i++) {
+		values[i] = (i < n1) ? a[i] : b[i - n1];
+		fromA[i] = (i < n1);
+	}
+	for (int i = 1; i < n; i++) {
+		double v = values[i];
+		int s = fromA[i];
+		int j = i - 1;
+		while (j >= 0 && values[j] > v) {
+			values[j + 1] = values[j];
+			fromA[j + 1] = fromA[j];
+			j--;
+		}
+		values[j + 1] = v;
+		fromA[j + 1] = s;
+	}
+
+	double rankSumA = 0.0;
+	double tieTerm = 0.0;
+	for (int i = 0; i < n;) {
+		int j = i;
+		while (j + 1 < n && values[j + 1] == values[i])
+			j++;
+
+		double rank = (i + j) / 2.0 + 1.0;
+		double ties = j - i + 1;
+		for (int k = i; k <= j; k++) {
+			if (fromA[k])
+				rankSumA += rank;
+		}
+		tieTerm += ties * ties * ties - ties;
+		i = j + 1;
+	}
+
+	free(values);
+	free(fromA);
+
+	double u = rankSumA - n1 * (n1 + 1) / 2.0;
+	double mean = n1 * (double)n2 / 2.0;
+	double variance = n1 * (double)n2 / 12.0 * ((n + 1) - tieTerm / ((double)n * (n - 1)));
+	if (variance <= 0.0)
+		return 1.0;
+
+	double z = (fabs(u - mean) - 0.5) / sqrt(variance);
+	if (z < 0.0)
+		z = 0.0;
+	return erfc(z / sqrt(2.0));
+}
+
+int harnessCompare(const char* baselinePath, const char* candidatePath, double thresholdPercent) {
+	harness_file baseline, candidate;
+	int regressions = 0;
+	int inconclusive = 0;
+	int missing = 0;
+
+	if (!loadFile(baselinePath, &baseline))
+		return 1;
+	if (!loadFile(candidatePath, &candidate)) {
+		freeFile(&baseline);
+		return 1;
+	}
+
+	printf("BENCHMARK COMPARISON\n");
+	printf("	Baseline: \"%s\", candidate: \"%s\"\n", baselinePath, candidatePath);
+	printf("	A change is flagged when Mann-Whitney p < %.2f and |median change| >= the larger of %.1f%%\n", HARNESS_ALPHA, thresholdPercent);
+	printf("	and the noise floor (%.0f x MAD / median of the noisier run). Cases whose floor is above\n", HARNESS_NOISE_MADS);
+	printf("	%.1f%%, or with fewer than %d samples, cannot resolve a change that small and are inconclusive\n", thresholdPercent, HARNESS_MIN_SAMPLES);
+	printf("		%-40s %12s %12s %9s %8s %9s  %s\n", "Benchmark", "Baseline", "Candidate", "Change", "Floor", "p", "Verdict");
+
+	for (int i = 0; i < candidate.resultCount; i++) {
+		harness_result* c = &candidate.results[i];
+		harness_result* b = NULL;
+		for (int j = 0; j < baseline.resultCount; j++) {
+			if (!strcmp(baseline.results[j].name, c->name))
+				b = &baseline.results[j];
+		}
+
+		if (!b) {
+			printf("		%-40s %12s %12s %9s %8s %9s  %s\n", c->name, "-", "-", "-", "-", "-", "new");
+			continue;
+		}
+
+		double p = mannWhitneyP(b->samples, b->count, c->samples, c->count);
+
+		harness_stats bs, cs;
+		harnessStats(b->samples, b->count, &bs);
+		harnessStats(c->samples, c->count, &cs);
+		double change = (bs.median != 0.0) ? 100.0 * (cs.median - bs.median) / fabs(bs.median) : 0.0;
+
+		// A shift within either run's own spread is not evidence of a change, however small
+		// p is. Taking the noisier run keeps the verdict the same when the files are swapped.
+		double noiseFloor = HARNESS_NOISE_MADS * fmax(relativeMad(&bs), relativeMad(&cs));
+		int resolvable = noiseFloor <= thresholdPercent && b->count >= HARNESS_MIN_SAMPLES && c->count >= HARNESS_MIN_SAMPLES;
+		if (noiseFloor < thresholdPercent)
+			noiseFloor = thresholdPercent;
+
+		const char* verdict = "same";
+		if (p < HARNESS_ALPHA && fabs(change) >= noiseFloor) {
+			int worse = c->lowerIsBetter ? (change > 0.0) : (change < 0.0);
+			verdict = worse ? "REGRESSION" : "improvement";
+			if (worse)
+				regressions++;
+		}
+		else if (!resolvable) {
+			verdict = "inconclusive";
+			inconclusive++;
+		}
+
+		printf("		%-40s %12.4g %12.4g %8.2f%% %7.2f%% %9.2g  %s\n", c->name, bs.median, cs.median, change, noiseFloor, p, verdict);
+	}
+
+	// A case can vanish when an upgrade disables the feature it measures; that fails the gate too
+	for (int i = 0; i < baseline.resultCount; i++) {
+		harness_result* b = &baseline.results[i];
+		int found = 0;
+
+		for (int j = 0; j < candidate.resultCount && !found; j++)
+			found = !strcmp(candidate.results[j].name, b->name);
+
+		if (!found) {
+			harness_stats bs;
+			harnessStats(b->samples, b->count, &bs);
+			printf("		%-40s %12.4g %12s %9s %8s %9s  %s\n", b->name, bs.median, "-", "-", "-", "-", "MISSING");
+			missing++;
+		}
+	}
+
+	printf("	CPUID differences:\n");
+	int differences = diffCpuid(&baseline, &candidate);
+	if (!differences)
+		printf("		None\n");
+
+	printf("	%d regression(s) found, %d inconclusive, %d benchmark(s) missing from the candidate.\n", regressions, inconclusive, missing);
+
+	freeFile(&baseline);
+	freeFile(&candidate);
+
+	// Distinct exit codes let upgrade gates tell regressions from errors, and
+	// results too noisy to vouch for from a clean pass
+	if (regressions || missing)
+		return 2;
+	return inconclusive ? 3 : 0;
+}
+
+#endif
@@ -0,0 +1,61 @@
+#ifndef HARNESS_H
+
+#define HARNESS_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define HARNESS_DEFAULT_OUTPUT "bench_results.txt"
+#define HARNESS_DEFAULT_SAMPLES 100
+#define HARNESS_DEFAULT_WARMUP 3
+#define HARNESS_MAX_CASES 128
+
+// Below 6 samples per run the U test in compare cannot reach p < 0.01 even when the
+// two runs do not overlap at all; 10 leaves some margin and a meaningful MAD
+#define HARNESS_MIN_SAMPLES 10
+
+// Minimum median change, in percent, for compare to flag a difference
+#define HARNESS_DEFAULT_THRESHOLD 2.0
+
+// Returns one measurement, in the case's unit
+typedef double (*harness_sample_fn)(void* context);
+
+typedef struct {
+	char name[64];
+	const char* unit;
+	int lowerIsBetter;
+	harness_sample_fn sample;
+	void* context;
+} harness_case;
+
+typedef struct {
+	int cpu;
+	int samples;
+	int warmup;
+} harness_options;
+
+typedef struct {
+	double median;
+	double p99;
+	double mad;
+	double mean;
+	double min;
+	double max;
+} harness_stats;
+
+int harnessCompareU64(const void* a, const void* b);
+uint64_t harnessPercentileU64(const uint64_t* sorted, uint32_t count, double p);
+void harnessStats(double* samples, int count, harness_stats* stats);
+int harnessInvariantTsc();
+int harnessWaitForStableClock();
+int harnessRun(const harness_case* cases, int count, const harness_options* options, const char* outputPath);
+int harnessCompare(const char* baselinePath, const char* candidatePath, double thresholdPercent);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,140 @@
+#if defined(__linux__)
+
+#define _GNU_SOURCE
+
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <immintrin.h>
+#include <sys/random.h>
+
+#include "cpuid_ex.h"
+#include "hwrandom.h"
+
+// Intel recommends retrying a failed RDRAND up to 10 times before giving up
+#define RDRAND_RETRIES 10
+
+// Consecutive refills that needed getrandom() before a thread stops trying RDRAND
+#define HWRANDOM_MAX_FAILED_REFILLS 3
+
+#if defined(__x86_64__)
+typedef unsigned long long rdrand_word;
+#define RDRAND_STEP _rdrand64_step
+#else
+typedef unsigned int rdrand_word;
+#define RDRAND_STEP _rdrand32_step
+#endif
+
+static pthread_once_t initOnce = PTHREAD_ONCE_INIT;
+static int rdrandSupported = 0;
+
+static __thread uint8_t buffer[HWRANDOM_BUFFER_SIZE] __attribute__((aligned(64)));
+static __thread size_t available = 0;
+static __thread int failedRefills = 0;
+static __thread int source = -1;
+
+static void hwRandomForkChild() {
+	// The child inherits the forking thread's buffer; it must not replay those bytes
+	memset(buffer, 0, sizeof(buffer));
+	available = 0;
+}
+
+static void hwRandomInit() {
+	cpuid_regs regs = {};
+
+	cpuid(1, &regs);
+	rdrandSupported = (regs.ecx & 0x40000000) ? 1 : 0;
+	pthread_atfork(NULL, NULL, hwRandomForkChild);
+}
+
+__attribute__((target("rdrnd")))
+static size_t fillRdrand(uint8_t* buf, size_t len) {
+	size_t filled = 0;
+
+	while (filled < len) {
+		rdrand_word value = 0;
+		int ok = 0;
+
+		for (int i = 0; i < RDRAND_RETRIES && !ok; i++) {
+			// Some AMD parts return all ones with CF set after a resume; treat that as a failure
+			ok = RDRAND_STEP(&value) && value != (rdrand_word)~0ULL;
+		}
+		if (!ok)
+			break;
+
+		size_t n = (len - filled < sizeof(value)) ? len - filled : sizeof(value);
+		memcpy(buf + filled, &value, n);
+		filled += n;
+	}
+
+	return filled;
+}
+
+static int fillGetrandom(uint8_t* buf, size_t len) {
+	while (len > 0) {
+		ssize_t n = getrandom(buf, len, 0);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		buf += n;
+		len -= (size_t)n;
+	}
+
+	return 0;
+}
+
+static int fillBulk(uint8_t* buf, size_t len) {
+	if (source != HWRANDOM_SOURCE_RDRAND)
+		return fillGetrandom(buf, len);
+
+	size_t filled = fillRdrand(buf, len);
+	if (filled == len) {
+		failedRefills = 0;
+		return 0;
+	}
+
+	// The DRNG is exhausted or broken; finish this refill from the kernel
+	if (++failedRefills >= HWRANDOM_MAX_FAILED_REFILLS)
+		source = HWRANDOM_SOURCE_GETRANDOM;
+	return fillGetrandom(buf + filled, len - filled);
+}
+
+int hwRandomSource() {
+	pthread_once(&initOnce, hwRandomInit);
+	if (source < 0)
+		source = rdrandSupported ? HWRANDOM_SOURCE_RDRAND : HWRANDOM_SOURCE_GETRANDOM;
+	return source;
+}
+
+int hwRandomBytes(void* buf, size_t len) {
+	uint8_t* out = (uint8_t*)buf;
+
+	hwRandomSource();
+	while (len > 0) {
+		if (available == 0) {
+			// Requests larger than the buffer bypass it entirely
+			if (len >= HWRANDOM_BUFFER_SIZE)
+				return fillBulk(out, len);
+			if (fillBulk(buffer, HWRANDOM_BUFFER_SIZE) < 0)
+				return -1;
+			available = HWRANDOM_BUFFER_SIZE;
+		}
+
+		size_t n = (len < available) ? len : available;
+		uint8_t* src = buffer + HWRANDOM_BUFFER_SIZE - available;
+		memcpy(out, src, n);
+
+		// Never hand the same bytes out twice
+		memset(src, 0, n);
+		available -= n;
+		out += n;
+		len -= n;
+	}
+
+	return 0;
+}
+
+#endif
@@ -0,0 +1,24 @@
+#ifndef HWRANDOM_H
+
+#define HWRANDOM_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define HWRANDOM_SOURCE_RDRAND 0
+#define HWRANDOM_SOURCE_GETRANDOM 1
+
+// Bytes held in each thread's buffer between bulk refills
+#define HWRANDOM_BUFFER_SIZE 512
+
+int hwRandomBytes(void* buf, size_t len);
+int hwRandomSource();
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,402 @@
+#if defined(__linux__)
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#include "cpuid_ex.h"
+#include "timing.h"
+#include "perfstat.h"
+
+#define STAT_MAX_EVENTS 5
+
+// Descriptors kept free for stdio and the pipe on top of the counters
+#define STAT_FD_HEADROOM 32
+
+// Used when CPUID does not report a counter count, e.g. in VMs that hide leaf 0xA
+#define STAT_DEFAULT_COUNTERS 4
+
+#define EV_CYCLES 0
+#define EV_INSTRUCTIONS 1
+#define EV_CACHE_REFS 2
+#define EV_CACHE_MISSES 3
+#define EV_BRANCH_MISSES 4
+
+#define EV_TASK_CLOCK 0
+#define EV_CONTEXT_SWITCHES 1
+#define EV_MIGRATIONS 2
+#define EV_PAGE_FAULTS 3
+
+typedef struct {
+	uint32_t type;
+	uint64_t config;
+	const char* name;
+} stat_event;
+
+typedef struct {
+	uint64_t value;
+	uint64_t enabled;
+	uint64_t running;
+} stat_reading;
+
+static const stat_event hardwareEvents[] = {
+	{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES, "cycles" },
+	{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS, "instructions" },
+	{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_REFERENCES, "cache-references" },
+	{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES, "cache-misses" },
+	{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES, "branch-misses" },
+};
+
+static const stat_event softwareEvents[] = {
+	{ PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK, "task-clock" },
+	{ PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES, "context-switches" },
+	{ PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CPU_MIGRATIONS, "cpu-migrations" },
+	{ PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS, "page-faults" },
+};
+
+static long perfEventOpen(struct perf_event_attr* attr, pid_t pid, int cpu, int groupFd, unsigned long flags) {
+	return syscall(SYS_perf_event_open, attr, pid, cpu, groupFd, flags);
+}
+
+static int getCounterCount() {
+	cpuid_regs regs = {};
+
+	cpuid(0, &regs);
+	uint32_t maxBasic = regs.eax;
+	char vendor[13];
+	memcpy(vendor, &regs.ebx, 4);
+	memcpy(vendor + 4, &regs.edx, 4);
+	memcpy(vendor + 8, &regs.ecx, 4);
+	vendor[12] = '\0';
+
+	if (!strcmp(vendor, "AuthenticAMD")) {
+		cpuid(0x80000000, &regs);
+		uint32_t maxExtended = regs.eax;
+
+		if (maxExtended >= 0x80000022) {
+			cpuid(0x80000022, &regs);
+			if (regs.eax & 0x1)
+				return (int)(regs.ebx & 0xF);
+		}
+
+		// PerfCtrExtCore raises the core counter count from 4 to 6
+		cpuid(0x80000001, &regs);
+		return (regs.ecx & 0x800000) ? 6 : 4;
+	}
+
+	if (maxBasic >= 0xA) {
+		cpuid(0xA, &regs);
+		if ((regs.eax & 0xFF) > 0)
+			return (int)((regs.eax >> 8) & 0xFF);
+	}
+
+	return STAT_DEFAULT_COUNTERS;
+}
+
+static int kernelCountingRestricted() {
+	// perf_event_paranoid >= 2 forbids counting kernel mode for unprivileged users
+	int level = 2;
+	FILE* f = fopen("/proc/sys/kernel/perf_event_paranoid", "r");
+
+	if (f) {
+		if (fscanf(f, "%d", &level) != 1)
+			level = 2;
+		fclose(f);
+	}
+
+	return level >= 2 && geteuid() != 0;
+}
+
+// One descriptor per event per CPU quickly passes the usual soft limit of 1024,
+// so raise it as far as the hard limit allows. Returns the resulting soft limit.
+static rlim_t raiseFileLimit(rlim_t needed) {
+	struct rlimit limit;
+
+	if (getrlimit(RLIMIT_NOFILE, &limit) != 0)
+		return 0;
+
+	needed += STAT_FD_HEADROOM;
+	if (limit.rlim_cur != RLIM_INFINITY && limit.rlim_cur < needed) {
+		limit.rlim_cur = (limit.rlim_max != RLIM_INFINITY && limit.rlim_max < needed) ? limit.rlim_max : needed;
+		setrlimit(RLIMIT_NOFILE, &limit);
+		getrlimit(RLIMIT_NOFILE, &limit);
+	}
+
+	return limit.rlim_cur;
+}
+
+static void printFileLimitHint(int err, rlim_t limit) {
+	if (err == EMFILE)
+		printf("The open file limit is %llu; raise it with ulimit -n.\n", (unsigned long long)limit);
+	else if (err == ENFILE)
+		printf("The system-wide open file limit was reached; check /proc/sys/fs/file-max.\n");
+	else
+		printf("Check /proc/sys/kernel/perf_event_paranoid or run with CAP_PERFMON.\n");
+}
+
+static void closeCounters(int* fds, int count) {
+	for (int i = 0; i < count; i++) {
+		if (fds[i] >= 0)
+			close(fds[i]);
+		fds[i] = -1;
+	}
+}
+
+static int openCounters(const stat_event* events, int eventCount, int groupSize, pid_t pid, const int* cpuList, int cpus, int* fds, const char** failed) {
+	int excludeKernel = kernelCountingRestricted();
+
+	for (int cpu = 0; cpu < cpus; cpu++) {
+		int leader = -1;
+
+		for (int e = 0; e < eventCount; e++) {
+			struct perf_event_attr attr;
+			memset(&attr, 0, sizeof(attr));
+			attr.size = sizeof(attr);
+			attr.type = events[e].type;
+			attr.config = events[e].config;
+			attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+			attr.inherit = 1;
+			attr.exclude_kernel = excludeKernel;
+			attr.exclude_hv = 1;
+
+			// Start a new group every groupSize events; the kernel multiplexes groups
+			if (e % groupSize == 0) {
+				attr.disabled = 1;
+				attr.enable_on_exec = 1;
+				leader = -1;
+			}
+
+			int fd = (int)perfEventOpen(&attr, pid, cpuList[cpu], leader, PERF_FLAG_FD_CLOEXEC);
+			if (fd < 0) {
+				int err = errno;
+				*failed = events[e].name;
+				closeCounters(fds, cpu * eventCount + e);
+				errno = err;
+				return 0;
+			}
+
+			fds[cpu * eventCount + e] = fd;
+			if (e % groupSize == 0)
+				leader = fd;
+		}
+	}
+
+	return 1;
+}
+
+static void readCounters(int* fds, int eventCount, int cpus, stat_reading* readings, int* multiplexed) {
+	*multiplexed = 0;
+
+	for (int i = 0; i < eventCount * cpus; i++) {
+		stat_reading r = {};
+
+		if (read(fds[i], &r, sizeof(r)) != sizeof(r))
+			memset(&r, 0, sizeof(r));
+
+		// Scale for the time the event was actually on a counter
+		if (r.running > 0 && r.running < r.enabled) {
+			r.value = (uint64_t)((double)r.value * (double)r.enabled / (double)r.running);
+			*multiplexed = 1;
+		}
+		else if (r.running == 0) {
+			r.value = 0;
+		}
+		readings[i] = r;
+	}
+}
+
+static void printHardwareRow(const char* label, const uint64_t* v) {
+	double ipc = v[EV_CYCLES] ? (double)v[EV_INSTRUCTIONS] / (double)v[EV_CYCLES] : 0.0;
+	double missRate = v[EV_CACHE_REFS] ? 100.0 * (double)v[EV_CACHE_MISSES] / (double)v[EV_CACHE_REFS] : 0.0;
+	double branchMpki = v[EV_INSTRUCTIONS] ? 1000.0 * (double)v[EV_BRANCH_MISSES] / (double)v[EV_INSTRUCTIONS] : 0.0;
+
+	printf("		%-5s %15llu %15llu %6.2f %14llu %14llu %7.2f%% %14llu %7.2f\n", label,
+		(unsigned long long)v[EV_CYCLES], (unsigned long long)v[EV_INSTRUCTIONS], ipc,
+		(unsigned long long)v[EV_CACHE_REFS], (unsigned long long)v[EV_CACHE_MISSES], missRate,
+		(unsigned long long)v[EV_BRANCH_MISSES], branchMpki);
+}
+
+static void printSoftwareRow(const char* label, const uint64_t* v) {
+	printf("		%-5s %14.3f %17llu %15llu %12llu\n", label, (double)v[EV_TASK_CLOCK] / 1e6,
+		(unsigned long long)v[EV_CONTEXT_SWITCHES], (unsigned long long)v[EV_MIGRATIONS],
+		(unsigned long long)v[EV_PAGE_FAULTS]);
+}
+
+static void printReport(int hardware, int eventCount, const int* cpuList, int cpus, stat_reading* readings) {
+	uint64_t totals[STAT_MAX_EVENTS] = {};
+
+	if (hardware)
+		printf("		%-5s %15s %15s %6s %14s %14s %8s %14s %7s\n", "CPU", "cycles", "instructions", "IPC",
+			"cache-refs", "cache-misses", "miss", "branch-misses", "MPKI");
+	else
+		printf("		%-5s %14s %17s %15s %12s\n", "CPU", "task-clock ms", "context-switches", "cpu-migrations", "page-faults");
+
+	for (int cpu = 0; cpu < cpus; cpu++) {
+		uint64_t values[STAT_MAX_EVENTS] = {};
+		int active = 0;
+
+		for (int e = 0; e < eventCount; e++) {
+			values[e] = readings[cpu * eventCount + e].value;
+			totals[e] += values[e];
+			if (values[e])
+				active = 1;
+		}
+
+		// Only list CPUs the command actually ran on
+		if (!active)
+			continue;
+
+		char label[16];
+		snprintf(label, sizeof(label), "%d", cpuList[cpu]);
+		if (hardware)
+			printHardwareRow(label, values);
+		else
+			printSoftwareRow(label, values);
+	}
+
+	if (hardware)
+		printHardwareRow("All", totals);
+	else
+		printSoftwareRow("All", totals);
+}
+
+int runPerfStat(int argc, char* argv[]) {
+	if (argc < 1) {
+		printf("No command specified! Usage: CPUTOOLS STAT -- <COMMAND> [ARGUMENTS]...\n");
+		return 1;
+	}
+
+	int cpuList[TIMING_MAX_CPUS];
+	int cpus = getCpuList(cpuList, TIMING_MAX_CPUS);
+	int groupSize = getCounterCount();
+	if (groupSize < 1)
+		groupSize = 1;
+
+	// The child waits on this pipe until its counters are attached
+	int gate[2];
+	if (pipe(gate) < 0) {
+		printf("Unable to create pipe: %s\n", strerror(errno));
+		return 1;
+	}
+
+	pid_t child = fork();
+	if (child < 0) {
+		printf("Unable to fork: %s\n", strerror(errno));
+		return 1;
+	}
+
+	if (child == 0) {
+		char go;
+		close(gate[1]);
+		if (read(gate[0], &go, 1) != 1)
+			_exit(127);
+		close(gate[0]);
+		execvp(argv[0], argv);
+		fprintf(stderr, "Unable to run \"%s\": %s\n", argv[0], strerror(errno));
+		_exit(127);
+	}
+
+	close(gate[0]);
+
+	int* fds = malloc((size_t)cpus * STAT_MAX_EVENTS * sizeof(int));
+	stat_reading* readings = calloc((size_t)cpus * STAT_MAX_EVENTS, sizeof(stat_reading));
+	if (!fds || !readings) {
+		kill(child, SIGKILL);
+		waitpid(child, NULL, 0);
+		free(fds);
+		free(readings);
+		return 1;
+	}
+	for (int i = 0; i < cpus * STAT_MAX_EVENTS; i++)
+		fds[i] = -1;
+
+	// Raised after the fork so the command still runs with the caller's limit
+	rlim_t fileLimit = raiseFileLimit((rlim_t)cpus * STAT_MAX_EVENTS);
+
+	const stat_event* events = hardwareEvents;
+	int eventCount = sizeof(hardwareEvents) / sizeof(hardwareEvents[0]);
+	const char* failedEvent = NULL;
+	int hardware = openCounters(events, eventCount, groupSize, child, cpuList, cpus, fds, &failedEvent);
+	int hardwareError = errno;
+
+	// Running out of descriptors says nothing about the PMU, so do not fall back
+	if (!hardware && (hardwareError == EMFILE || hardwareError == ENFILE)) {
+		printf("Unable to open %d counters (%d events on %d CPUs): %s\n", cpus * eventCount, eventCount, cpus, strerror(hardwareError));
+		printFileLimitHint(hardwareError, fileLimit);
+		kill(child, SIGKILL);
+		waitpid(child, NULL, 0);
+		free(fds);
+		free(readings);
+		return 1;
+	}
+
+	if (!hardware) {
+		// Restricted VMs and containers often expose no PMU; fall back to software events
+		events = softwareEvents;
+		eventCount = sizeof(softwareEvents) / sizeof(softwareEvents[0]);
+		const char* failedSoftware = NULL;
+		if (!openCounters(events, eventCount, eventCount, child, cpuList, cpus, fds, &failedSoftware)) {
+			int err = errno;
+			printf("Unable to open %s counter: %s\n", failedSoftware, strerror(err));
+			printFileLimitHint(err, fileLimit);
+			kill(child, SIGKILL);
+			waitpid(child, NULL, 0);
+			free(fds);
+			free(readings);
+			return 1;
+		}
+	}
+
+	uint64_t start = nowNs();
+	if (write(gate[1], "x", 1) != 1)
+		kill(child, SIGKILL);
+	close(gate[1]);
+
+	int status = 0;
+	while (waitpid(child, &status, 0) < 0 && errno == EINTR)
+		;
+	uint64_t elapsed = nowNs() - start;
+
+	int multiplexed = 0;
+	readCounters(fds, eventCount, cpus, readings, &multiplexed);
+	closeCounters(fds, cpus * eventCount);
+
+	printf("PERFORMANCE COUNTER STATISTICS\n");
+	printf("	Command: %s", argv[0]);
+	for (int i = 1; i < argc; i++)
+		printf(" %s", argv[i]);
+	printf("\n");
+	if (hardware) {
+		printf("	Mode: hardware, %d counter(s) per group, %d group(s)\n", groupSize, (eventCount + groupSize - 1) / groupSize);
+	}
+	else {
+		printf("	Mode: software (%s counter unavailable: %s)\n", failedEvent, strerror(hardwareError));
+	}
+	if (kernelCountingRestricted())
+		printf("	Kernel mode: excluded (perf_event_paranoid)\n");
+	if (multiplexed)
+		printf("	Counters were multiplexed; values are scaled estimates.\n");
+	printf("	Elapsed: %.3f s\n", (double)elapsed / 1e9);
+	if (WIFEXITED(status))
+		printf("	Exit status: %d\n", WEXITSTATUS(status));
+	else if (WIFSIGNALED(status))
+		printf("	Terminated by signal: %d\n", WTERMSIG(status));
+
+	printReport(hardware, eventCount, cpuList, cpus, readings);
+
+	free(fds);
+	free(readings);
+	return WIFEXITED(status) ? WEXITSTATUS(status) : 1;
+}
+
+#endif
@@ -0,0 +1,15 @@
+#ifndef PERFSTAT_H
+
+#define PERFSTAT_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+int runPerfStat(int argc, char* argv[]);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
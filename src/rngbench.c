@@ -0,0 +1,368 @@
+#if defined(__linux__)
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <immintrin.h>
+
+#include "cpuid_ex.h"
+#include "timing.h"
+#include "hwrandom.h"
+#include "harness.h"
+#include "rngbench.h"
+
+// Length of each timed run, and of each all-core harness sample, in nanoseconds
+#define RNG_DURATION_NS 200000000ULL
+#define RNG_CASE_NS 10000000ULL
+
+// Number of instruction calls between clock checks
+#define RNG_BATCH 64
+
+// Request size used for the buffered API, typical of a session token
+#define RNG_API_REQUEST 32
+
+// Calls timed per harness sample
+#define RNG_SAMPLE_CALLS 1024
+
+#define RNG_RDRAND 0
+#define RNG_RDSEED 1
+#define RNG_API 2
+#define RNG_COUNT 3
+
+static const char* rngNames[RNG_COUNT] = { "RDRAND", "RDSEED", "hwRandomBytes" };
+
+#if defined(__x86_64__)
+typedef unsigned long long rng_word;
+#define RDRAND_STEP _rdrand64_step
+#define RDSEED_STEP _rdseed64_step
+#else
+typedef unsigned int rng_word;
+#define RDRAND_STEP _rdrand32_step
+#define RDSEED_STEP _rdseed32_step
+#endif
+
+// Start line shared by every worker of one run, so all cores hit the generator together
+typedef struct {
+	volatile int ready;
+	volatile int start;
+	volatile int pinFailed;
+	uint64_t begin;
+	uint64_t deadline;
+} rng_gate;
+
+typedef struct {
+	int cpu;
+	int source;
+	rng_gate* gate;
+	uint64_t attempts;
+	uint64_t successes;
+	uint64_t bytes;
+	uint64_t elapsedNs;
+} rng_thread;
+
+typedef struct {
+	int started;
+	int pinFailed;
+	uint64_t attempts;
+	uint64_t successes;
+	uint64_t bytes;
+	uint64_t elapsedNs;
+} rng_totals;
+
+// All-core harness cases share the CPU list gathered when they were registered
+typedef struct {
+	int source;
+	int cpus;
+} rng_case;
+
+static int harnessCpuList[TIMING_MAX_CPUS];
+static rng_case harnessContexts[RNG_COUNT];
+
+__attribute__((target("rdrnd")))
+static void loopRdrand(rng_thread* t, uint64_t deadline) {
+	rng_word value, sink = 0;
+
+	do {
+		for (int i = 0; i < RNG_BATCH; i++) {
+			// One attempt per call, no retries, so failures are visible
+			if (RDRAND_STEP(&value)) {
+				t->successes++;
+				sink ^= value;
+			}
+		}
+		t->attempts += RNG_BATCH;
+	} while (nowNs() < deadline);
+
+	t->bytes = t->successes * sizeof(rng_word);
+	__asm__ volatile("" : : "r" (sink));
+}
+
+__attribute__((target("rdseed")))
+static void loopRdseed(rng_thread* t, uint64_t deadline) {
+	rng_word value, sink = 0;
+
+	do {
+		for (int i = 0; i < RNG_BATCH; i++) {
+			if (RDSEED_STEP(&value)) {
+				t->successes++;
+				sink ^= value;
+			}
+		}
+		t->attempts += RNG_BATCH;
+	} while (nowNs() < deadline);
+
+	t->bytes = t->successes * sizeof(rng_word);
+	__asm__ volatile("" : : "r" (sink));
+}
+
+static void loopApi(rng_thread* t, uint64_t deadline) {
+	uint8_t token[RNG_API_REQUEST];
+
+	do {
+		for (int i = 0; i < RNG_BATCH; i++) {
+			if (hwRandomBytes(token, sizeof(token)) == 0)
+				t->successes++;
+		}
+		t->attempts += RNG_BATCH;
+	} while (nowNs() < deadline);
+
+	t->bytes = t->successes * RNG_API_REQUEST;
+}
+
+__attribute__((target("rdrnd")))
+static double sampleRdrand(void* context) {
+	rng_word value, sink = 0;
+	(void)context;
+
+	uint64_t start = readTscOrdered();
+	for (int i = 0; i < RNG_SAMPLE_CALLS; i++) {
+		if (RDRAND_STEP(&value))
+			sink ^= value;
+	}
+	uint64_t ticks = readTscOrdered() - start;
+
+	__asm__ volatile("" : : "r" (sink));
+	return tscToNs(ticks) / RNG_SAMPLE_CALLS;
+}
+
+__attribute__((target("rdseed")))
+static double sampleRdseed(void* context) {
+	rng_word value, sink = 0;
+	(void)context;
+
+	uint64_t start = readTscOrdered();
+	for (int i = 0; i < RNG_SAMPLE_CALLS; i++) {
+		if (RDSEED_STEP(&value))
+			sink ^= value;
+	}
+	uint64_t ticks = readTscOrdered() - start;
+
+	__asm__ volatile("" : : "r" (sink));
+	return tscToNs(ticks) / RNG_SAMPLE_CALLS;
+}
+
+static double sampleApi(void* context) {
+	uint8_t token[RNG_API_REQUEST];
+	(void)context;
+
+	uint64_t start = readTscOrdered();
+	for (int i = 0; i < RNG_SAMPLE_CALLS; i++)
+		hwRandomBytes(token, sizeof(token));
+	uint64_t ticks = readTscOrdered() - start;
+
+	return tscToNs(ticks) / RNG_SAMPLE_CALLS;
+}
+
+static void* rngWorker(void* arg) {
+	rng_thread* t = (rng_thread*)arg;
+	rng_gate* gate = t->gate;
+
+	if (pinToCpu(t->cpu) != 0)
+		__atomic_store_n(&gate->pinFailed, 1, __ATOMIC_RELEASE);
+	__atomic_add_fetch(&gate->ready, 1, __ATOMIC_ACQ_REL);
+	while (!__atomic_load_n(&gate->start, __ATOMIC_ACQUIRE))
+		cpuRelax();
+
+	uint64_t deadline = gate->deadline;
+	switch (t->source) {
+		case RNG_RDRAND:
+			loopRdrand(t, deadline); break;
+		case RNG_RDSEED:
+			loopRdseed(t, deadline); break;
+		case RNG_API:
+			loopApi(t, deadline); break;
+	}
+	t->elapsedNs = nowNs() - gate->begin;
+
+	return NULL;
+}
+
+// Runs one source on cpuList[0..threads-1] at once and sums the workers' counts.
+// Returns the number of workers that started.
+static int measureRng(int source, const int* cpuList, int threads, uint64_t durationNs, rng_totals* totals) {
+	rng_thread* workers = calloc((size_t)threads, sizeof(rng_thread));
+	pthread_t* handles = calloc((size_t)threads, sizeof(pthread_t));
+	rng_gate gate = {};
+
+	memset(totals, 0, sizeof(*totals));
+	if (!workers || !handles) {
+		free(workers);
+		free(handles);
+		return 0;
+	}
+
+	// Like freqwatch, run with however many workers actually started
+	int started = 0;
+	for (int i = 0; i < threads; i++) {
+		workers[i].cpu = cpuList[i];
+		workers[i].source = source;
+		workers[i].gate = &gate;
+		if (pthread_create(&handles[i], NULL, rngWorker, &workers[i]) != 0)
+			break;
+		started++;
+	}
+
+	// Release the workers only once all of them are pinned, with one deadline for everyone
+	while (__atomic_load_n(&gate.ready, __ATOMIC_ACQUIRE) < started)
+		cpuRelax();
+	gate.begin = nowNs();
+	gate.deadline = gate.begin + durationNs;
+	__atomic_store_n(&gate.start, 1, __ATOMIC_RELEASE);
+
+	for (int i = 0; i < started; i++) {
+		pthread_join(handles[i], NULL);
+		totals->attempts += workers[i].attempts;
+		totals->successes += workers[i].successes;
+		totals->bytes += workers[i].bytes;
+		if (workers[i].elapsedNs > totals->elapsedNs)
+			totals->elapsedNs = workers[i].elapsedNs;
+	}
+	totals->started = started;
+	totals->pinFailed = gate.pinFailed;
+
+	free(workers);
+	free(handles);
+	return started;
+}
+
+static double throughputMBs(const rng_totals* totals) {
+	return (totals->elapsedNs > 0) ? (double)totals->bytes * 1e3 / (double)totals->elapsedNs : 0.0;
+}
+
+static void runRng(int source, const int* cpuList, int threads) {
+	rng_totals totals;
+
+	if (!measureRng(source, cpuList, threads, RNG_DURATION_NS, &totals)) {
+		printf("		%-14s %3d thread(s): could not start any threads, skipping.\n", rngNames[source], threads);
+		return;
+	}
+
+	double failures = (totals.attempts > 0) ? 100.0 * (double)(totals.attempts - totals.successes) / (double)totals.attempts : 0.0;
+	double callNs = (totals.attempts > 0) ? (double)totals.elapsedNs * totals.started / (double)totals.attempts : 0.0;
+
+	printf("		%-14s %3d thread(s): %10.1f MB/s, %8.1f ns/call, %7.3f%% failed%s",
+		rngNames[source], totals.started, throughputMBs(&totals), callNs, failures,
+		totals.pinFailed ? " (some threads could not be pinned)" : "");
+	if (totals.started < threads)
+		printf(" (only %d of %d threads started)", totals.started, threads);
+	printf("\n");
+}
+
+static double sampleAllCores(void* context) {
+	rng_case* c = (rng_case*)context;
+	rng_totals totals;
+
+	measureRng(c->source, harnessCpuList, c->cpus, RNG_CASE_NS, &totals);
+	return throughputMBs(&totals);
+}
+
+static void detectRng(uint32_t* rdrand, uint32_t* rdseed) {
+	cpuid_regs regs = {};
+
+	cpuid(0, &regs);
+	uint32_t maxBasic = regs.eax;
+
+	cpuid(1, &regs);
+	*rdrand = (regs.ecx & 0x40000000);
+	*rdseed = 0;
+	if (maxBasic >= 7) {
+		cpuidex(7, 0, &regs);
+		*rdseed = (regs.ebx & 0x40000);
+	}
+}
+
+int rngBenchCases(harness_case* cases, int max) {
+	static const harness_sample_fn samplers[RNG_COUNT] = { sampleRdrand, sampleRdseed, sampleApi };
+	uint32_t rdrand, rdseed;
+	int cpus = getCpuList(harnessCpuList, TIMING_MAX_CPUS);
+	int count = 0;
+
+	detectRng(&rdrand, &rdseed);
+	for (int source = 0; source < RNG_COUNT && count < max; source++) {
+		if ((source == RNG_RDRAND && !rdrand) || (source == RNG_RDSEED && !rdseed))
+			continue;
+
+		memset(&cases[count], 0, sizeof(harness_case));
+		snprintf(cases[count].name, sizeof(cases[count].name), "rng.%s", rngNames[source]);
+		cases[count].unit = "ns";
+		cases[count].lowerIsBetter = 1;
+		cases[count].sample = samplers[source];
+		count++;
+	}
+
+	// Contention between cores is measured as combined throughput. Only every worker
+	// starting makes samples comparable, so a trial run decides whether to register.
+	for (int source = 0; source < RNG_COUNT && cpus > 1 && count < max; source++) {
+		if ((source == RNG_RDRAND && !rdrand) || (source == RNG_RDSEED && !rdseed))
+			continue;
+
+		rng_totals totals;
+		if (measureRng(source, harnessCpuList, cpus, RNG_CASE_NS, &totals) < cpus || totals.pinFailed)
+			continue;
+
+		rng_case* c = &harnessContexts[source];
+		c->source = source;
+		c->cpus = cpus;
+
+		memset(&cases[count], 0, sizeof(harness_case));
+		snprintf(cases[count].name, sizeof(cases[count].name), "rng.%s.all-cores", rngNames[source]);
+		cases[count].unit = "MB/s";
+		cases[count].lowerIsBetter = 0;
+		cases[count].sample = sampleAllCores;
+		cases[count].context = c;
+		count++;
+	}
+
+	return count;
+}
+
+int runRngBench() {
+	uint32_t rdrand, rdseed;
+	int cpuList[TIMING_MAX_CPUS];
+	int cpus = getCpuList(cpuList, TIMING_MAX_CPUS);
+
+	detectRng(&rdrand, &rdseed);
+
+	printf("HARDWARE RANDOM NUMBER GENERATOR\n");
+	printf("	RDRAND: %s\n", rdrand ? "Supported" : "Not supported");
+	printf("	RDSEED: %s\n", rdseed ? "Supported" : "Not supported");
+	printf("	hwRandomBytes source: %s\n", (hwRandomSource() == HWRANDOM_SOURCE_RDRAND) ? "RDRAND" : "getrandom()");
+	printf("	Throughput (RDRAND/RDSEED failures are not retried, hwRandomBytes serves %d-byte requests):\n", RNG_API_REQUEST);
+
+	for (int source = 0; source < RNG_COUNT; source++) {
+		if ((source == RNG_RDRAND && !rdrand) || (source == RNG_RDSEED && !rdseed))
+			continue;
+
+		runRng(source, cpuList, 1);
+		if (cpus > 1)
+			runRng(source, cpuList, cpus);
+	}
+
+	return 0;
+}
+
+#endif
@@ -0,0 +1,18 @@
+#ifndef RNGBENCH_H
+
+#define RNGBENCH_H
+
+#include "harness.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+int runRngBench();
+int rngBenchCases(harness_case* cases, int max);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
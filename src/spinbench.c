@@ -0,0 +1,857 @@
+#if defined(__linux__)
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#include "cpuid_ex.h"
+#include "timing.h"
+#include "harness.h"
+#include "spinbench.h"
+
+// Number of PAUSE instructions timed per trial, and number of trials
+#define PAUSE_BATCH 8000
+#define PAUSE_TRIALS 15
+
+// Samples collected for each wake-up latency histogram, and per harness sample
+#define WAKE_SAMPLES 2000
+#define WAKE_CASE_SAMPLES 100
+
+// Deadline used for the TPAUSE overshoot test, in nanoseconds
+#define TPAUSE_DELAY_NS 2000.0
+
+// Upper bound on how long a waiter sleeps in UMWAIT/MWAITX before re-checking
+#define WAIT_TIMEOUT_NS 100000.0
+
+// Writer delay range between wake-ups, in nanoseconds
+#define WAKE_DELAY_MIN_NS 5000.0
+#define WAKE_DELAY_MAX_NS 50000.0
+
+// Lock handoff test parameters
+#define HANDOFF_MAX_THREADS 4
+#define HANDOFF_SAMPLES 20000
+#define HANDOFF_DURATION_NS 200000000ULL
+#define HANDOFF_CASE_NS 5000000ULL
+#define HANDOFF_HOLD_PAUSES 4
+#define HANDOFF_BACKOFF_MAX 64
+#define HANDOFF_TPAUSE_NS 200.0
+
+// Futex park/wake round trips timed, and how long the initiator sleeps before each
+// one so the responder is parked by the time it is woken, in nanoseconds
+#define PARK_SAMPLES 2000
+#define PARK_CASE_SAMPLES 100
+#define PARK_SETTLE_NS 20000
+
+// Lower bound and fallback for the recommended spin budget, in PAUSE instructions
+#define SPIN_MIN_PAUSES 8
+#define SPIN_DEFAULT_PAUSES 64
+
+// Past this point a waiter is better off parking than spinning, in nanoseconds
+#define SPIN_MAX_NS 50000.0
+
+// Histogram buckets are powers of two starting at 2^HIST_FIRST_SHIFT ns
+#define HIST_BUCKETS 14
+#define HIST_FIRST_SHIFT 5
+#define HIST_BAR_WIDTH 40
+
+#define UMWAIT_C01 1
+#define MWAITX_TIMER_ENABLE 2
+#define MWAITX_HINT_C0 0xf0
+
+// Failures of the multi-threaded measurements, besides finding nothing to measure
+#define THREADS_UNPINNED -1
+#define THREADS_NOT_STARTED -2
+
+#define STRAT_SPIN 0
+#define STRAT_PAUSE 1
+#define STRAT_BACKOFF 2
+#define STRAT_TPAUSE 3
+#define STRAT_UMWAIT 4
+#define STRAT_MWAITX 5
+#define STRAT_COUNT 6
+
+static const char* strategyNames[STRAT_COUNT] = {
+	"spin", "pause", "backoff", "tpause", "umwait", "mwaitx"
+};
+
+typedef struct {
+	int waitpkg;
+	int monitorx;
+	double tscHz;
+	double pauseTicks;
+	double pauseNs;
+	double tpauseWakeNs;
+	double umwaitWakeNs;
+	double mwaitxWakeNs;
+	int handoffMeasured[STRAT_COUNT];
+	double handoffP50Ns[STRAT_COUNT];
+	double handoffP99Ns[STRAT_COUNT];
+	int parkMeasured;
+	double parkWakeP50Ns;
+	double parkWakeP99Ns;
+	int bestStrategy;
+	double spinBudgetNs;
+	uint32_t spinBudgetPauses;
+	long umwaitMaxTime;
+} spin_profile;
+
+typedef struct {
+	volatile uint64_t seq __attribute__((aligned(64)));
+	volatile uint64_t stamp __attribute__((aligned(64)));
+	volatile uint64_t ack __attribute__((aligned(64)));
+	volatile int abort;
+	uint32_t count;
+} wake_line;
+
+typedef struct {
+	volatile uint32_t ping __attribute__((aligned(64)));
+	volatile uint32_t pong __attribute__((aligned(64)));
+	uint32_t count;
+	int cpu;
+	int pinFailed;
+} park_line;
+
+// Harness cases for the multi-threaded tests; each sample is the median of one short round
+typedef struct {
+	int strategy;
+	int cpus;
+	int cpuList[HANDOFF_MAX_THREADS];
+} spin_case;
+
+typedef struct {
+	volatile uint32_t locked __attribute__((aligned(64)));
+	volatile uint64_t lastRelease __attribute__((aligned(64)));
+	volatile int lastOwner;
+	volatile int stop __attribute__((aligned(64)));
+	volatile int ready;
+	volatile int pinFailed;
+} handoff_lock;
+
+typedef struct {
+	int id;
+	int cpu;
+	int strategy;
+	int method;
+	wake_line* line;
+	handoff_lock* lock;
+	uint64_t* samples;
+	uint32_t count;
+	int pinFailed;
+} bench_thread;
+
+static spin_case harnessContexts[STRAT_COUNT + 3];
+
+static void umonitorAddr(volatile void* addr) {
+	// UMONITOR rax
+	__asm__ volatile(".byte 0xf3, 0x0f, 0xae, 0xf0" : : "a" (addr) : "memory");
+}
+
+static void umwaitUntil(uint32_t control, uint64_t deadline) {
+	// UMWAIT ecx, deadline in edx:eax
+	__asm__ volatile(".byte 0xf2, 0x0f, 0xae, 0xf1"
+		: : "c" (control), "a" ((uint32_t)deadline), "d" ((uint32_t)(deadline >> 32))
+		: "memory", "cc");
+}
+
+static void tpauseUntil(uint32_t control, uint64_t deadline) {
+	// TPAUSE ecx, deadline in edx:eax
+	__asm__ volatile(".byte 0x66, 0x0f, 0xae, 0xf1"
+		: : "c" (control), "a" ((uint32_t)deadline), "d" ((uint32_t)(deadline >> 32))
+		: "memory", "cc");
+}
+
+static void monitorxAddr(volatile void* addr) {
+	// MONITORX rax, ecx, edx
+	__asm__ volatile(".byte 0x0f, 0x01, 0xfa" : : "a" (addr), "c" (0), "d" (0) : "memory");
+}
+
+static void mwaitxTimed(uint32_t timeout) {
+	// MWAITX eax, ecx, ebx
+	__asm__ volatile(".byte 0x0f, 0x01, 0xfb"
+		: : "a" (MWAITX_HINT_C0), "b" (timeout), "c" (MWAITX_TIMER_ENABLE)
+		: "memory");
+}
+
+static void printHistogram(const char* name, uint64_t* ticks, uint32_t count) {
+	uint32_t buckets[HIST_BUCKETS] = {};
+	uint32_t peak = 1;
+
+	for (uint32_t i = 0; i < count; i++) {
+		uint64_t ns = (uint64_t)tscToNs(ticks[i]);
+		int b = 0;
+		while (b < HIST_BUCKETS - 1 && ns >= (1ULL << (HIST_FIRST_SHIFT + b)))
+			b++;
+		buckets[b]++;
+	}
+
+	for (int b = 0; b < HIST_BUCKETS; b++) {
+		if (buckets[b] > peak)
+			peak = buckets[b];
+	}
+
+	printf("	%s (ns, %u samples):\n", name, count);
+	for (int b = 0; b < HIST_BUCKETS; b++) {
+		if (b < HIST_BUCKETS - 1)
+			printf("		< %6llu : %6u ", 1ULL << (HIST_FIRST_SHIFT + b), buckets[b]);
+		else
+			printf("		>=%6llu : %6u ", 1ULL << (HIST_FIRST_SHIFT + b - 1), buckets[b]);
+		for (uint32_t j = 0; j < buckets[b] * HIST_BAR_WIDTH / peak; j++)
+			putchar('#');
+		putchar('\n');
+	}
+}
+
+static void detectWaitFeatures(spin_profile* profile) {
+	cpuid_regs regs = {};
+
+	cpuid(0, &regs);
+	uint32_t maxBasic = regs.eax;
+
+	if (maxBasic >= 7) {
+		cpuidex(7, 0, &regs);
+		profile->waitpkg = (regs.ecx & 0x20) ? 1 : 0;
+	}
+
+	cpuid(0x80000000, &regs);
+	uint32_t maxExtended = regs.eax;
+
+	if (maxExtended >= 0x80000001) {
+		cpuid(0x80000001, &regs);
+		profile->monitorx = (regs.ecx & 0x20000000) ? 1 : 0;
+	}
+
+	// The kernel caps every UMWAIT/TPAUSE at this many TSC cycles
+	profile->umwaitMaxTime = -1;
+	FILE* f = fopen("/sys/devices/system/cpu/umwait_control/max_time", "r");
+	if (f) {
+		if (fscanf(f, "%ld", &profile->umwaitMaxTime) != 1)
+			profile->umwaitMaxTime = -1;
+		fclose(f);
+	}
+}
+
+static uint64_t timePauseBatch() {
+	uint64_t start = readTscOrdered();
+	for (int i = 0; i < PAUSE_BATCH; i += 8) {
+		cpuRelax(); cpuRelax(); cpuRelax(); cpuRelax();
+		cpuRelax(); cpuRelax(); cpuRelax(); cpuRelax();
+	}
+	return readTscOrdered() - start;
+}
+
+static double samplePauseNs(void* context) {
+	(void)context;
+	return tscToNs(timePauseBatch()) / PAUSE_BATCH;
+}
+
+static void measurePause(spin_profile* profile) {
+	uint64_t trials[PAUSE_TRIALS];
+
+	// One untimed batch so the first trial does not pay for the clock ramping up
+	timePauseBatch();
+	for (int t = 0; t < PAUSE_TRIALS; t++)
+		trials[t] = timePauseBatch();
+
+	qsort(trials, PAUSE_TRIALS, sizeof(uint64_t), harnessCompareU64);
+	profile->pauseTicks = (double)trials[PAUSE_TRIALS / 2] / PAUSE_BATCH;
+	profile->pauseNs = profile->pauseTicks * 1e9 / profile->tscHz;
+}
+
+static void measureTpause(spin_profile* profile) {
+	uint64_t* samples = malloc(WAKE_SAMPLES * sizeof(uint64_t));
+	if (!samples)
+		return;
+
+	uint64_t delay = nsToTsc(TPAUSE_DELAY_NS);
+	for (uint32_t i = 0; i < WAKE_SAMPLES; i++) {
+		uint64_t deadline = readTsc() + delay;
+		uint64_t now;
+
+		// TPAUSE may return early on interrupts or the OS time limit
+		while ((now = readTsc()) < deadline)
+			tpauseUntil(UMWAIT_C01, deadline);
+		samples[i] = now - deadline;
+	}
+
+	printHistogram("TPAUSE wake-up latency past deadline", samples, WAKE_SAMPLES);
+	qsort(samples, WAKE_SAMPLES, sizeof(uint64_t), harnessCompareU64);
+	profile->tpauseWakeNs = tscToNs(harnessPercentileU64(samples, WAKE_SAMPLES, 0.5));
+	free(samples);
+}
+
+static void* wakeWaiter(void* arg) {
+	bench_thread* t = (bench_thread*)arg;
+	wake_line* line = t->line;
+	uint64_t timeout = nsToTsc(WAIT_TIMEOUT_NS);
+
+	// Keep going when the pin fails so the writer is not left waiting on acks
+	t->pinFailed = (pinToCpu(t->cpu) != 0);
+	for (uint32_t i = 0; i < line->count; i++) {
+		for (;;) {
+			if (t->method == STRAT_UMWAIT)
+				umonitorAddr(&line->seq);
+			else
+				monitorxAddr(&line->seq);
+
+			if (__atomic_load_n(&line->seq, __ATOMIC_ACQUIRE) != i)
+				break;
+			if (__atomic_load_n(&line->abort, __ATOMIC_ACQUIRE))
+				return NULL;
+
+			if (t->method == STRAT_UMWAIT)
+				umwaitUntil(UMWAIT_C01, readTsc() + timeout);
+			else
+				mwaitxTimed((uint32_t)timeout);
+		}
+
+		uint64_t woke = readTsc();
+		t->samples[i] = woke - line->stamp;
+		__atomic_store_n(&line->ack, i + 1, __ATOMIC_RELEASE);
+	}
+
+	return NULL;
+}
+
+static void* wakeWriter(void* arg) {
+	bench_thread* t = (bench_thread*)arg;
+	wake_line* line = t->line;
+	uint64_t minDelay = nsToTsc(WAKE_DELAY_MIN_NS);
+	uint64_t delayRange = nsToTsc(WAKE_DELAY_MAX_NS) - minDelay;
+	uint32_t rng = 0x9e3779b9;
+
+	t->pinFailed = (pinToCpu(t->cpu) != 0);
+	for (uint32_t i = 0; i < line->count; i++) {
+		while (__atomic_load_n(&line->ack, __ATOMIC_ACQUIRE) != i) {
+			if (__atomic_load_n(&line->abort, __ATOMIC_ACQUIRE))
+				return NULL;
+			cpuRelax();
+		}
+
+		// Give the waiter time to arm the monitor and go to sleep
+		rng ^= rng << 13; rng ^= rng >> 17; rng ^= rng << 5;
+		uint64_t until = readTsc() + minDelay + rng % delayRange;
+		while (readTsc() < until)
+			cpuRelax();
+
+		line->stamp = readTscOrdered();
+		__atomic_store_n(&line->seq, i + 1, __ATOMIC_RELEASE);
+	}
+
+	return NULL;
+}
+
+// Fills samples with count wake-up latencies in TSC cycles, waiting on cpuList[0]
+// and writing from cpuList[1]. Returns 1, 0 when out of memory, or a THREADS_ failure.
+static int collectMonitorWake(int method, const int* cpuList, uint64_t* samples, uint32_t count) {
+	wake_line* line = aligned_alloc(64, sizeof(wake_line));
+	if (!line)
+		return 0;
+	memset(line, 0, sizeof(wake_line));
+	line->count = count;
+
+	bench_thread waiter = { .id = 0, .cpu = cpuList[0], .method = method, .line = line, .samples = samples };
+	bench_thread writer = { .id = 1, .cpu = cpuList[1], .method = method, .line = line };
+	pthread_t waiterThread, writerThread;
+
+	if (pthread_create(&waiterThread, NULL, wakeWaiter, &waiter) != 0) {
+		free(line);
+		return THREADS_NOT_STARTED;
+	}
+	if (pthread_create(&writerThread, NULL, wakeWriter, &writer) != 0) {
+		// The waiter would otherwise sleep on the monitored line forever
+		__atomic_store_n(&line->abort, 1, __ATOMIC_RELEASE);
+		pthread_join(waiterThread, NULL);
+		free(line);
+		return THREADS_NOT_STARTED;
+	}
+	pthread_join(waiterThread, NULL);
+	pthread_join(writerThread, NULL);
+	free(line);
+
+	return (waiter.pinFailed || writer.pinFailed) ? THREADS_UNPINNED : 1;
+}
+
+static double measureMonitorWake(int method, const int* cpuList) {
+	uint64_t* samples = malloc(WAKE_SAMPLES * sizeof(uint64_t));
+	const char* name = (method == STRAT_UMWAIT) ? "UMWAIT" : "MWAITX";
+	double p50 = 0.0;
+
+	if (!samples)
+		return p50;
+
+	int result = collectMonitorWake(method, cpuList, samples, WAKE_SAMPLES);
+	if (result == THREADS_NOT_STARTED) {
+		printf("	%s cross-core wake-up latency: unable to start threads, skipping.\n", name);
+	}
+	else if (result == THREADS_UNPINNED) {
+		printf("	%s cross-core wake-up latency: unable to pin threads to CPUs %d and %d, skipping.\n",
+			name, cpuList[0], cpuList[1]);
+	}
+	else if (result > 0) {
+		printHistogram((method == STRAT_UMWAIT) ? "UMWAIT cross-core wake-up latency" : "MWAITX cross-core wake-up latency",
+			samples, WAKE_SAMPLES);
+		qsort(samples, WAKE_SAMPLES, sizeof(uint64_t), harnessCompareU64);
+		p50 = tscToNs(harnessPercentileU64(samples, WAKE_SAMPLES, 0.5));
+	}
+
+	free(samples);
+	return p50;
+}
+
+static void lockAcquire(handoff_lock* lock, int strategy) {
+	uint32_t backoff = 1;
+
+	for (;;) {
+		// Test-and-test-and-set: only attempt the exchange when the lock looks free
+		if (!__atomic_load_n(&lock->locked, __ATOMIC_RELAXED) &&
+			!__atomic_exchange_n(&lock->locked, 1, __ATOMIC_ACQUIRE))
+			return;
+
+		switch (strategy) {
+			case STRAT_SPIN:
+				break;
+			case STRAT_PAUSE:
+				cpuRelax(); break;
+			case STRAT_BACKOFF:
+				for (uint32_t i = 0; i < backoff; i++)
+					cpuRelax();
+				if (backoff < HANDOFF_BACKOFF_MAX)
+					backoff <<= 1;
+				break;
+			case STRAT_TPAUSE:
+				tpauseUntil(UMWAIT_C01, readTsc() + nsToTsc(HANDOFF_TPAUSE_NS)); break;
+			case STRAT_UMWAIT:
+				umonitorAddr(&lock->locked);
+				if (__atomic_load_n(&lock->locked, __ATOMIC_RELAXED))
+					umwaitUntil(UMWAIT_C01, readTsc() + nsToTsc(WAIT_TIMEOUT_NS));
+				break;
+			case STRAT_MWAITX:
+				monitorxAddr(&lock->locked);
+				if (__atomic_load_n(&lock->locked, __ATOMIC_RELAXED))
+					mwaitxTimed((uint32_t)nsToTsc(WAIT_TIMEOUT_NS));
+				break;
+		}
+	}
+}
+
+static void* handoffWorker(void* arg) {
+	bench_thread* t = (bench_thread*)arg;
+	handoff_lock* lock = t->lock;
+
+	// An unpinned worker inherits the main thread's affinity and shares its core
+	if (pinToCpu(t->cpu) != 0)
+		__atomic_store_n(&lock->pinFailed, 1, __ATOMIC_RELEASE);
+	__atomic_add_fetch(&lock->ready, 1, __ATOMIC_ACQ_REL);
+
+	while (!__atomic_load_n(&lock->stop, __ATOMIC_RELAXED)) {
+		lockAcquire(lock, t->strategy);
+
+		// Only count acquisitions that moved the lock between threads
+		uint64_t acquired = readTsc();
+		if (lock->lastOwner != t->id && lock->lastOwner >= 0 && t->count < HANDOFF_SAMPLES)
+			t->samples[t->count++] = acquired - lock->lastRelease;
+
+		for (int i = 0; i < HANDOFF_HOLD_PAUSES; i++)
+			cpuRelax();
+
+		lock->lastOwner = t->id;
+		lock->lastRelease = readTsc();
+		__atomic_store_n(&lock->locked, 0, __ATOMIC_RELEASE);
+
+		// Leave a short gap so waiters on other cores can win the lock
+		for (int i = 0; i < HANDOFF_HOLD_PAUSES; i++)
+			cpuRelax();
+	}
+
+	return NULL;
+}
+
+static int measureHandoff(int strategy, const int* cpuList, int threads, uint64_t durationNs, double* p50Ns, double* p99Ns) {
+	handoff_lock* lock = aligned_alloc(64, sizeof(handoff_lock));
+	uint64_t* samples = malloc((size_t)threads * HANDOFF_SAMPLES * sizeof(uint64_t));
+	bench_thread workers[HANDOFF_MAX_THREADS];
+	pthread_t handles[HANDOFF_MAX_THREADS];
+
+	if (!lock || !samples) {
+		free(lock);
+		free(samples);
+		return 0;
+	}
+	memset(lock, 0, sizeof(handoff_lock));
+	lock->lastOwner = -1;
+
+	int started = 0;
+	for (int i = 0; i < threads; i++) {
+		memset(&workers[i], 0, sizeof(bench_thread));
+		workers[i].id = i;
+		workers[i].cpu = cpuList[i];
+		workers[i].strategy = strategy;
+		workers[i].lock = lock;
+		workers[i].samples = samples + (size_t)i * HANDOFF_SAMPLES;
+		if (pthread_create(&handles[i], NULL, handoffWorker, &workers[i]) != 0)
+			break;
+		started++;
+	}
+
+	while (__atomic_load_n(&lock->ready, __ATOMIC_ACQUIRE) < started)
+		cpuRelax();
+
+	// Sleep rather than spin so the main thread never competes with a worker for its core
+	if (started == threads && !__atomic_load_n(&lock->pinFailed, __ATOMIC_ACQUIRE)) {
+		struct timespec window = { (time_t)(durationNs / 1000000000ULL), (long)(durationNs % 1000000000ULL) };
+		while (nanosleep(&window, &window) != 0 && errno == EINTR)
+			;
+	}
+	__atomic_store_n(&lock->stop, 1, __ATOMIC_RELEASE);
+
+	// Pack every thread's samples together
+	uint32_t total = 0;
+	for (int i = 0; i < started; i++) {
+		pthread_join(handles[i], NULL);
+		memmove(samples + total, workers[i].samples, workers[i].count * sizeof(uint64_t));
+		total += workers[i].count;
+	}
+
+	int result = (total > 0) ? 1 : 0;
+	if (started < threads)
+		result = THREADS_NOT_STARTED;
+	else if (lock->pinFailed)
+		result = THREADS_UNPINNED;
+	else if (total > 0) {
+		qsort(samples, total, sizeof(uint64_t), harnessCompareU64);
+		*p50Ns = tscToNs(harnessPercentileU64(samples, total, 0.5));
+		*p99Ns = tscToNs(harnessPercentileU64(samples, total, 0.99));
+	}
+
+	free(lock);
+	free(samples);
+	return result;
+}
+
+static void futexWait(volatile uint32_t* addr, uint32_t expected) {
+	syscall(SYS_futex, addr, FUTEX_WAIT_PRIVATE, expected, NULL, NULL, 0);
+}
+
+static void futexWake(volatile uint32_t* addr) {
+	syscall(SYS_futex, addr, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+}
+
+static void settle() {
+	struct timespec gap = { 0, PARK_SETTLE_NS };
+	nanosleep(&gap, NULL);
+}
+
+static void* parkResponder(void* arg) {
+	park_line* line = (park_line*)arg;
+
+	line->pinFailed = (pinToCpu(line->cpu) != 0);
+	for (uint32_t i = 0; i < line->count; i++) {
+		while (__atomic_load_n(&line->ping, __ATOMIC_ACQUIRE) == i)
+			futexWait(&line->ping, i);
+		__atomic_store_n(&line->pong, i + 1, __ATOMIC_RELEASE);
+		futexWake(&line->pong);
+	}
+
+	return NULL;
+}
+
+static int measureParkWake(const int* cpuList, int cpus, uint32_t count, double* p50Ns, double* p99Ns) {
+	// Times the initiator waking a parked responder and parking until the responder
+	// wakes it back: two futex wake-ups, each including the sleeper being scheduled
+	park_line* line = aligned_alloc(64, sizeof(park_line));
+	uint64_t* samples = malloc(count * sizeof(uint64_t));
+	pthread_t responder;
+
+	if (!line || !samples) {
+		free(line);
+		free(samples);
+		return 0;
+	}
+	memset(line, 0, sizeof(park_line));
+	line->count = count;
+
+	// With one CPU the wake-up also pays for a context switch, as it would in practice
+	line->cpu = (cpus >= 2) ? cpuList[1] : cpuList[0];
+	if (pthread_create(&responder, NULL, parkResponder, line) != 0) {
+		free(line);
+		free(samples);
+		return 0;
+	}
+
+	for (uint32_t i = 0; i < count; i++) {
+		settle();
+		uint64_t start = readTscOrdered();
+		__atomic_store_n(&line->ping, i + 1, __ATOMIC_RELEASE);
+		futexWake(&line->ping);
+		while (__atomic_load_n(&line->pong, __ATOMIC_ACQUIRE) == i)
+			futexWait(&line->pong, i);
+		samples[i] = readTscOrdered() - start;
+	}
+	pthread_join(responder, NULL);
+
+	int measured = !line->pinFailed;
+	if (measured) {
+		qsort(samples, count, sizeof(uint64_t), harnessCompareU64);
+		*p50Ns = tscToNs(harnessPercentileU64(samples, count, 0.5)) / 2.0;
+		*p99Ns = tscToNs(harnessPercentileU64(samples, count, 0.99)) / 2.0;
+	}
+
+	free(line);
+	free(samples);
+	return measured;
+}
+
+static void recommendBudget(spin_profile* profile) {
+	// A spin-then-park waiter should spin for about as long as parking and being woken
+	// would take. Spinning longer wastes more than parking would cost, and spinning
+	// less parks waiters whose lock would have arrived sooner than the wake-up.
+	// Handoff latency only measures cache-line transfer, so it picks the strategy.
+	double floorNs = SPIN_MIN_PAUSES * profile->pauseNs;
+
+	profile->bestStrategy = -1;
+	for (int s = 0; s < STRAT_COUNT; s++) {
+		if (!profile->handoffMeasured[s])
+			continue;
+		if (profile->bestStrategy < 0 || profile->handoffP50Ns[s] < profile->handoffP50Ns[profile->bestStrategy])
+			profile->bestStrategy = s;
+	}
+
+	if (profile->parkMeasured)
+		profile->spinBudgetNs = profile->parkWakeP50Ns;
+	else
+		profile->spinBudgetNs = SPIN_DEFAULT_PAUSES * profile->pauseNs;
+
+	if (profile->spinBudgetNs > SPIN_MAX_NS)
+		profile->spinBudgetNs = SPIN_MAX_NS;
+	if (profile->spinBudgetNs < floorNs)
+		profile->spinBudgetNs = floorNs;
+
+	profile->spinBudgetPauses = (profile->pauseNs > 0.0) ? (uint32_t)(profile->spinBudgetNs / profile->pauseNs + 0.5) : 0;
+}
+
+static int writeProfile(const spin_profile* profile, const char* path) {
+	FILE* f = fopen(path, "w");
+	if (!f)
+		return 0;
+
+	fprintf(f, "# CPUTOOLS spin-wait profile. One key=value per line; unknown keys should be ignored.\n");
+	fprintf(f, "# spin_budget_ns is the median futex park/wake latency: past that point parking is cheaper\n");
+	fprintf(f, "# than spinning on. Handoff latencies only rank the spin strategies.\n");
+	fprintf(f, "version=1\n");
+	fprintf(f, "tsc_hz=%.0f\n", profile->tscHz);
+	fprintf(f, "pause_tsc_cycles=%.2f\n", profile->pauseTicks);
+	fprintf(f, "pause_ns=%.2f\n", profile->pauseNs);
+	fprintf(f, "waitpkg=%d\n", profile->waitpkg);
+	fprintf(f, "monitorx=%d\n", profile->monitorx);
+	if (profile->umwaitMaxTime >= 0)
+		fprintf(f, "umwait_max_tsc_cycles=%ld\n", profile->umwaitMaxTime);
+	if (profile->waitpkg)
+		fprintf(f, "tpause_wake_p50_ns=%.1f\n", profile->tpauseWakeNs);
+	if (profile->umwaitWakeNs > 0.0)
+		fprintf(f, "umwait_wake_p50_ns=%.1f\n", profile->umwaitWakeNs);
+	if (profile->mwaitxWakeNs > 0.0)
+		fprintf(f, "mwaitx_wake_p50_ns=%.1f\n", profile->mwaitxWakeNs);
+	for (int s = 0; s < STRAT_COUNT; s++) {
+		if (!profile->handoffMeasured[s])
+			continue;
+		fprintf(f, "handoff_%s_p50_ns=%.1f\n", strategyNames[s], profile->handoffP50Ns[s]);
+		fprintf(f, "handoff_%s_p99_ns=%.1f\n", strategyNames[s], profile->handoffP99Ns[s]);
+	}
+	if (profile->parkMeasured) {
+		fprintf(f, "park_wake_p50_ns=%.1f\n", profile->parkWakeP50Ns);
+		fprintf(f, "park_wake_p99_ns=%.1f\n", profile->parkWakeP99Ns);
+	}
+	if (profile->bestStrategy >= 0)
+		fprintf(f, "best_strategy=%s\n", strategyNames[profile->bestStrategy]);
+	fprintf(f, "spin_budget_ns=%.0f\n", profile->spinBudgetNs);
+	fprintf(f, "spin_budget_pauses=%u\n", profile->spinBudgetPauses);
+
+	fclose(f);
+	return 1;
+}
+
+static double sampleHandoff(void* context) {
+	spin_case* c = (spin_case*)context;
+	double p50 = 0.0, p99 = 0.0;
+
+	measureHandoff(c->strategy, c->cpuList, c->cpus, HANDOFF_CASE_NS, &p50, &p99);
+	return p50;
+}
+
+static double sampleMonitorWake(void* context) {
+	spin_case* c = (spin_case*)context;
+	uint64_t samples[WAKE_CASE_SAMPLES];
+
+	if (collectMonitorWake(c->strategy, c->cpuList, samples, WAKE_CASE_SAMPLES) <= 0)
+		return 0.0;
+	qsort(samples, WAKE_CASE_SAMPLES, sizeof(uint64_t), harnessCompareU64);
+	return tscToNs(harnessPercentileU64(samples, WAKE_CASE_SAMPLES, 0.5));
+}
+
+static double sampleParkWake(void* context) {
+	spin_case* c = (spin_case*)context;
+	double p50 = 0.0, p99 = 0.0;
+
+	measureParkWake(c->cpuList, c->cpus, PARK_CASE_SAMPLES, &p50, &p99);
+	return p50;
+}
+
+static int addCase(harness_case* cases, int count, int max, const char* name, harness_sample_fn sample, void* context) {
+	if (count >= max)
+		return count;
+
+	memset(&cases[count], 0, sizeof(harness_case));
+	snprintf(cases[count].name, sizeof(cases[count].name), "%s", name);
+	cases[count].unit = "ns";
+	cases[count].lowerIsBetter = 1;
+	cases[count].sample = sample;
+	cases[count].context = context;
+	return count + 1;
+}
+
+int spinBenchCases(harness_case* cases, int max) {
+	spin_profile features = {};
+	int cpuList[TIMING_MAX_CPUS];
+	int cpus = getCpuList(cpuList, TIMING_MAX_CPUS);
+	int contexts = 0;
+	int count = 0;
+	char name[64];
+	double p50, p99;
+
+	detectWaitFeatures(&features);
+	count = addCase(cases, count, max, "spin.pause", samplePauseNs, NULL);
+
+	// Each threaded case is only registered once a trial round has run, so a machine
+	// that cannot start or pin the threads leaves the case out rather than recording zeros
+	spin_case* park = &harnessContexts[contexts];
+	park->cpus = (cpus < 2) ? cpus : 2;
+	memcpy(park->cpuList, cpuList, (size_t)park->cpus * sizeof(int));
+	if (measureParkWake(park->cpuList, park->cpus, PARK_CASE_SAMPLES, &p50, &p99)) {
+		count = addCase(cases, count, max, "spin.park", sampleParkWake, park);
+		contexts++;
+	}
+
+	if (cpus < 2)
+		return count;
+
+	for (int method = STRAT_UMWAIT; method <= STRAT_MWAITX; method++) {
+		if ((method == STRAT_UMWAIT && !features.waitpkg) || (method == STRAT_MWAITX && !features.monitorx))
+			continue;
+
+		spin_case* wake = &harnessContexts[contexts];
+		uint64_t samples[WAKE_CASE_SAMPLES];
+		wake->strategy = method;
+		wake->cpus = 2;
+		memcpy(wake->cpuList, cpuList, 2 * sizeof(int));
+		if (collectMonitorWake(method, wake->cpuList, samples, WAKE_CASE_SAMPLES) > 0) {
+			snprintf(name, sizeof(name), "spin.wake.%s", strategyNames[method]);
+			count = addCase(cases, count, max, name, sampleMonitorWake, wake);
+			contexts++;
+		}
+	}
+
+	for (int s = 0; s < STRAT_COUNT; s++) {
+		if ((s == STRAT_TPAUSE || s == STRAT_UMWAIT) && !features.waitpkg)
+			continue;
+		if (s == STRAT_MWAITX && !features.monitorx)
+			continue;
+
+		spin_case* handoff = &harnessContexts[contexts];
+		handoff->strategy = s;
+		handoff->cpus = (cpus < HANDOFF_MAX_THREADS) ? cpus : HANDOFF_MAX_THREADS;
+		memcpy(handoff->cpuList, cpuList, (size_t)handoff->cpus * sizeof(int));
+		if (measureHandoff(s, handoff->cpuList, handoff->cpus, HANDOFF_CASE_NS, &p50, &p99) > 0) {
+			snprintf(name, sizeof(name), "spin.handoff.%s", strategyNames[s]);
+			count = addCase(cases, count, max, name, sampleHandoff, handoff);
+			contexts++;
+		}
+	}
+
+	return count;
+}
+
+int runSpinBench(const char* profilePath) {
+	spin_profile profile = {};
+	int cpuList[TIMING_MAX_CPUS];
+	int cpus = getCpuList(cpuList, TIMING_MAX_CPUS);
+
+	detectWaitFeatures(&profile);
+	profile.tscHz = getTscHz();
+
+	printf("SPIN-WAIT CALIBRATION\n");
+	printf("	TSC frequency: %.0f Hz\n", profile.tscHz);
+	printf("	WAITPKG (UMONITOR/UMWAIT/TPAUSE): %s\n", profile.waitpkg ? "Supported" : "Not supported");
+	printf("	MONITORX/MWAITX: %s\n", profile.monitorx ? "Supported" : "Not supported");
+	if (profile.umwaitMaxTime >= 0)
+		printf("	UMWAIT OS time limit: %ld TSC cycles\n", profile.umwaitMaxTime);
+
+	pinToCpu(cpuList[0]);
+	printf("	Clock stabilized: %s\n", harnessWaitForStableClock() ? "Yes" : "No, results may be noisy");
+	measurePause(&profile);
+	printf("	PAUSE latency: %.2f TSC cycles (%.2f ns)\n", profile.pauseTicks, profile.pauseNs);
+
+	if (profile.waitpkg)
+		measureTpause(&profile);
+
+	if (cpus >= 2) {
+		if (profile.waitpkg)
+			profile.umwaitWakeNs = measureMonitorWake(STRAT_UMWAIT, cpuList);
+		if (profile.monitorx)
+			profile.mwaitxWakeNs = measureMonitorWake(STRAT_MWAITX, cpuList);
+
+		int threads = (cpus < HANDOFF_MAX_THREADS) ? cpus : HANDOFF_MAX_THREADS;
+		printf("	Lock handoff latency (%d threads):\n", threads);
+		for (int s = 0; s < STRAT_COUNT; s++) {
+			if ((s == STRAT_TPAUSE || s == STRAT_UMWAIT) && !profile.waitpkg)
+				continue;
+			if (s == STRAT_MWAITX && !profile.monitorx)
+				continue;
+
+			int result = measureHandoff(s, cpuList, threads, HANDOFF_DURATION_NS, &profile.handoffP50Ns[s], &profile.handoffP99Ns[s]);
+			profile.handoffMeasured[s] = (result > 0);
+			if (result > 0)
+				printf("		%-8s: p50 %8.1f ns, p99 %8.1f ns\n", strategyNames[s], profile.handoffP50Ns[s], profile.handoffP99Ns[s]);
+			else if (result == THREADS_NOT_STARTED)
+				printf("		%-8s: unable to start %d worker threads, skipping\n", strategyNames[s], threads);
+			else if (result == THREADS_UNPINNED)
+				printf("		%-8s: unable to pin every worker to its own CPU, skipping\n", strategyNames[s]);
+			else
+				printf("		%-8s: no handoffs observed\n", strategyNames[s]);
+		}
+	}
+	else {
+		printf("	Cross-core wake-up and lock handoff tests need at least 2 logical CPUs, skipping.\n");
+	}
+
+	profile.parkMeasured = measureParkWake(cpuList, cpus, PARK_SAMPLES, &profile.parkWakeP50Ns, &profile.parkWakeP99Ns);
+	if (profile.parkMeasured)
+		printf("	Futex park/wake latency: p50 %.1f ns, p99 %.1f ns\n", profile.parkWakeP50Ns, profile.parkWakeP99Ns);
+	else
+		printf("	Futex park/wake latency: unable to measure, using a default budget.\n");
+
+	recommendBudget(&profile);
+	printf("	Recommended spin budget: %.0f ns (%u PAUSE iterations)", profile.spinBudgetNs, profile.spinBudgetPauses);
+	if (profile.bestStrategy >= 0)
+		printf(", best strategy: %s\n", strategyNames[profile.bestStrategy]);
+	else
+		printf("\n");
+
+	if (!writeProfile(&profile, profilePath)) {
+		printf("Unable to write spin-wait profile \"%s\"!\n", profilePath);
+		return 1;
+	}
+
+	printf("Profile written to \"%s\".\n", profilePath);
+	return 0;
+}
+
+#endif
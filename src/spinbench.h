@@ -0,0 +1,20 @@
+#ifndef SPINBENCH_H
+
+#define SPINBENCH_H
+
+#include "harness.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define SPIN_PROFILE_DEFAULT "spin_profile.txt"
+
+int runSpinBench(const char* profilePath);
+int spinBenchCases(harness_case* cases, int max);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,99 @@
+// Linux only: built on pthreads, sched affinity and GCC/Clang inline assembly
+#if defined(__linux__)
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <sched.h>
+
+#include "timing.h"
+
+#if !defined(__GNUC__) && !defined(__clang__)
+	#error "Only GCC, Clang are supported!"
+#endif
+
+#if !defined(__x86_64__) && !defined(__i386__)
+	#error "Only i386, x86-64 are supported!"
+#endif
+
+// Length of the TSC calibration window, in nanoseconds
+#define TSC_CALIBRATION_NS 50000000ULL
+
+static double tscHz = 0.0;
+
+uint64_t nowNs() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+double getTscHz() {
+	if (tscHz > 0.0)
+		return tscHz;
+
+	// Measure the TSC against the monotonic clock over a short busy window
+	uint64_t startNs = nowNs();
+	uint64_t startTsc = readTscOrdered();
+	uint64_t endNs;
+
+	do {
+		endNs = nowNs();
+	} while (endNs - startNs < TSC_CALIBRATION_NS);
+
+	uint64_t endTsc = readTscOrdered();
+	tscHz = (double)(endTsc - startTsc) * 1e9 / (double)(endNs - startNs);
+	return tscHz;
+}
+
+double tscToNs(uint64_t ticks) {
+	return (double)ticks * 1e9 / getTscHz();
+}
+
+uint64_t nsToTsc(double ns) {
+	return (uint64_t)(ns * getTscHz() / 1e9);
+}
+
+int getCpuCount() {
+	cpu_set_t set;
+
+	if (sched_getaffinity(0, sizeof(set), &set) == 0 && CPU_COUNT(&set) > 0)
+		return CPU_COUNT(&set);
+
+	long n = sysconf(_SC_NPROCESSORS_ONLN);
+	return (n < 1) ? 1 : (int)n;
+}
+
+int getCpuList(int* cpus, int max) {
+	cpu_set_t set;
+	int count = 0;
+
+	// Online CPUs need not be numbered contiguously, and cpusets or taskset narrow them
+	// further, so report the calling thread's affinity mask rather than 0..N-1.
+	// Call this before pinning, or the list collapses to the pinned CPU.
+	if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+		for (int cpu = 0; cpu < CPU_SETSIZE && count < max; cpu++) {
+			if (CPU_ISSET(cpu, &set))
+				cpus[count++] = cpu;
+		}
+	}
+
+	if (count == 0) {
+		long n = sysconf(_SC_NPROCESSORS_ONLN);
+		for (int cpu = 0; cpu < n && count < max; cpu++)
+			cpus[count++] = cpu;
+	}
+
+	return count;
+}
+
+int pinToCpu(int cpu) {
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	return sched_setaffinity(0, sizeof(set), &set);
+}
+
+#endif
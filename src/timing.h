@@ -0,0 +1,43 @@
+#ifndef TIMING_H
+
+#define TIMING_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define TIMING_MAX_CPUS 1024
+
+// Inline so timed loops measure the instruction itself, not a call and return around it
+static inline uint64_t readTsc() {
+	uint32_t lo, hi;
+	__asm__ volatile("rdtsc" : "=a" (lo), "=d" (hi));
+	return ((uint64_t)hi << 32) | lo;
+}
+
+static inline uint64_t readTscOrdered() {
+	// LFENCE keeps earlier instructions from retiring after the TSC read
+	uint32_t lo, hi;
+	__asm__ volatile("lfence\n\trdtsc" : "=a" (lo), "=d" (hi) : : "memory");
+	return ((uint64_t)hi << 32) | lo;
+}
+
+static inline void cpuRelax() {
+	__asm__ volatile("pause" ::: "memory");
+}
+
+uint64_t nowNs();
+double getTscHz();
+double tscToNs(uint64_t ticks);
+uint64_t nsToTsc(double ns);
+int getCpuCount();
+int getCpuList(int* cpus, int max);
+int pinToCpu(int cpu);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif